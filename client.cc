@@ -19,20 +19,24 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <X11/Xatom.h>
 #include "windowlab.h"
 
+// the layout in windowlab.h is meant to keep this to half of what it once was (520 bytes, plus 80 for the size hints)
+static_assert(sizeof(void*) != 8 || sizeof(Client) <= 296, "Client has grown");
+
 
 ClientPointer
 ClientTracker::find(Window w, int mode) {
     if (mode == FRAME) {
         for (auto& client : _clients) {
-            if (client->getFrame() == w) {
+            if (client->getFrame() == w && !client->isBeingRemoved()) {
                 return client;
             }
         }
     } else {
         for (auto& client : _clients) {
-            if (client->getWindow() == w) {
+            if (client->getWindow() == w && !client->isBeingRemoved()) {
                 return client;
             }
         }
@@ -50,11 +54,17 @@ Client::setWMState(int state) noexcept
 	data[0] = state;
 	data[1] = None; //Icon? We don't need no steenking icon.
     DisplayManager::instance().changeProperty(_window, wm_state, wm_state, 32, PropModeReplace, (unsigned char*)data, 2);
+    // only we are supposed to set WM_STATE, so what we just wrote is what is there
+    _wmState = static_cast<std::int8_t>(state);
 }
 
 long 
-Client::getWMState() const noexcept
+Client::getWMState() noexcept
 {
+    countPropertyLookup(CachedProperty::WMState, _wmState >= 0);
+    if (_wmState >= 0) {
+        return _wmState;
+    }
 /* If we can't find a WM_STATE we're going to have to assume
  * Withdrawn. This is not exactly optimal, since we can't really
  * distinguish between the case where no WM has run yet and when the
@@ -70,10 +80,121 @@ Client::getWMState() const noexcept
 		state = *((long *)data);
 		XFree(data);
 	}
+    _wmState = static_cast<std::int8_t>(state);
 	return state;
 
 }
 
+/* We only ever ask about a couple of protocols, so rather than keeping
+ * the client's whole list we keep a bit for each of those. */
+static std::uint8_t
+protocolBit(Atom protocol) noexcept {
+    const Atom known[] = { wm_delete, wm_take_focus, net_wm_sync_request };
+    for (std::size_t i = 0; i < std::size(known); ++i) {
+        if (known[i] == protocol) {
+            return static_cast<std::uint8_t>(1u << i);
+        }
+    }
+    return 0;
+}
+
+void
+Client::setProtocols(const std::vector<Atom>& protocols) noexcept {
+    _protocols = 0;
+    for (auto protocol : protocols) {
+        _protocols |= protocolBit(protocol);
+    }
+    _protocolsFetched = true;
+}
+
+bool
+Client::supportsProtocol(Atom protocol) noexcept {
+    countPropertyLookup(CachedProperty::Protocols, _protocolsFetched);
+    if (!_protocolsFetched) {
+        std::vector<Atom> list;
+        int n = 0;
+        if (Atom* protocols = nullptr; XGetWMProtocols(DisplayManager::instance().getDisplay(), _window, &protocols, &n)) {
+            list.assign(protocols, protocols + n);
+            XFree(protocols);
+        }
+        setProtocols(list);
+    }
+    return _protocols & protocolBit(protocol);
+}
+
+ClientWMHints::ClientWMHints(const XWMHints& hints) noexcept : window_group(hints.window_group), flags(static_cast<std::uint32_t>(hints.flags)),
+    initial_state(hints.initial_state), input(hints.input) { }
+
+const ClientWMHints*
+Client::getWMHints() noexcept {
+    countPropertyLookup(CachedProperty::Hints, _wmHintsFetched);
+    if (!_wmHintsFetched) {
+        _wmHints = ClientWMHints();
+        if (auto hints = DisplayManager::instance().getWMHints(_window); hints) {
+            _wmHints = ClientWMHints(*hints);
+            XFree(hints);
+        }
+        _wmHintsFetched = true;
+    }
+    // no flags means none of the fields are there, which is as good as no hints at all
+    return _wmHints.flags ? &_wmHints : nullptr;
+}
+
+bool
+Client::acceptsInput() noexcept {
+    auto hints = getWMHints();
+    return !hints || !(hints->flags & InputHint) || hints->input;
+}
+
+/* A passive grab lasts as long as the frame does, so there's no need
+ * to ask for it again every time the pointer comes back in. */
+void
+Client::grabButtons() noexcept {
+    if (!_buttonsGrabbed) {
+        XGrabButton(DisplayManager::instance().getDisplay(), AnyButton, AnyModifier, _frame, False, ButtonMask, GrabModeSync, GrabModeSync, None, None);
+        _buttonsGrabbed = true;
+    }
+}
+
+ClientSizeHints::ClientSizeHints(const XSizeHints& hints) noexcept : flags(static_cast<std::uint32_t>(hints.flags)),
+    min_width(hints.min_width), min_height(hints.min_height), max_width(hints.max_width), max_height(hints.max_height),
+    width_inc(hints.width_inc), height_inc(hints.height_inc), base_width(hints.base_width), base_height(hints.base_height),
+    win_gravity(hints.win_gravity) { }
+
+ClientSizeHints*
+Client::getSize() noexcept {
+    countPropertyLookup(CachedProperty::NormalHints, !_sizeStale);
+    if (_sizeStale) {
+        XSizeHints hints {};
+        _size = DisplayManager::instance().getWMNormalHints(_window, &hints) ? ClientSizeHints(hints) : ClientSizeHints();
+        _sizeStale = false;
+    }
+    return &_size;
+}
+
+XftDraw*
+Client::getXftDraw() noexcept {
+    if (!_xftdraw) {
+        auto& dm = DisplayManager::instance();
+        _xftdraw = XftDrawCreate(dm.getDisplay(), static_cast<Drawable>(_frame), dm.getDefaultVisual(), dm.getDefaultColormap());
+    }
+    return _xftdraw;
+}
+
+void
+Client::propertyChanged(Atom property) noexcept {
+    if (property == wm_protos) {
+        _protocolsFetched = false;
+        ResizeSync::instance().forget(_window);
+    } else if (property == net_wm_sync_request_counter) {
+        ResizeSync::instance().forget(_window);
+    } else if (property == XA_WM_HINTS) {
+        _wmHintsFetched = false;
+    } else if (property == XA_WM_NORMAL_HINTS) {
+        _sizeStale = true;
+    }
+}
+
 void
 Client::sendConfig() noexcept {
     XConfigureEvent ce;
@@ -90,11 +211,22 @@ Client::sendConfig() noexcept {
     DisplayManager::instance().sendEvent(_window, False, StructureNotifyMask, ce);
 }
 
+void
+Client::applyGeometry() noexcept {
+    auto& dm = DisplayManager::instance();
+    if (_frame) {
+        dm.moveResizeWindow(_frame, _x, _y - getBarHeight(), _width, _height + getBarHeight());
+    }
+    dm.moveResizeWindow(_window, 0, getBarHeight(), _width, _height);
+    if (shape) {
+        resizeShape();
+    }
+    sendConfig();
+}
+
 Client::~Client() {
-	XftDrawDestroy(_xftdraw);
-    if (_size) {
-        XFree(_size);
-        _size = nullptr;
+    if (_xftdraw) {
+        XftDrawDestroy(_xftdraw);
     }
 }
 
@@ -105,7 +237,53 @@ Client::removeFromView() noexcept {
     dm.reparentWindow(_window, dm.getRoot(), _x, _y);
     dm.setWindowBorderWidth(_window, 1);
     dm.removeFromSaveSet(_window);
-    dm.destroyWindow(_frame);
+    detachFrame();
+}
+
+/* A hidden client's window is unmapped, so it can sit on the root
+ * window without being seen until it is wanted again. Until then it
+ * doesn't need a frame, an Xft context or a laid out frame title. */
+void
+Client::releaseFrame() noexcept {
+    if (!_frame) {
+        return;
+    }
+    if constexpr (debugActive()) {
+        err("releasing the frame of ", (_name ? *_name : ""), ", hidden for ",
+                std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - _hiddenSince).count(), "s");
+    }
+    ErrorTracker::Scope scope(_window);
+    DisplayManager::instance().reparentWindow(_window, DisplayManager::instance().getRoot(), _x, _y);
+    detachFrame();
+    _frameTitle = CachedGlyphRun();
+}
+
+void
+Client::detachFrame() noexcept {
+    if (!_frame) {
+        return;
+    }
+    auto& dm = DisplayManager::instance();
+    if (_xftdraw) {
+        XftDrawDestroy(_xftdraw);
+        _xftdraw = nullptr;
+    }
+    if (_hasBeenShaped) {
+        // the next client to get this frame mightn't be shaped
+        XShapeCombineMask(dm.getDisplay(), _frame, ShapeBounding, 0, 0, None, ShapeSet);
+        XShapeCombineMask(dm.getDisplay(), _frame, ShapeClip, 0, 0, None, ShapeSet);
+        _hasBeenShaped = 0;
+    }
+    WindowPool::instance().release(PooledWindow::Frame, _frame);
+    _frame = None;
+    _buttonsGrabbed = false;
+}
+
+/* The title and class are shared through the StringArena, so they're
+ * reported with that rather than counted against each client. */
+std::size_t
+Client::memoryUsage() const noexcept {
+    return sizeof(Client) + _frameTitle.memoryUsage() + _taskbarTitle.memoryUsage();
 }
 
 
@@ -118,37 +296,62 @@ Client::removeFromView() noexcept {
  *
  * The 'withdrawing' argument specifies if the client is actually
  * (destroying itself||being destroyed by us) or if we are merely
- * cleaning up its data structures when we exit mid-session. */
+ * cleaning up its data structures when we exit mid-session.
+ *
+ * Closing a tab group or killing a process tree takes dozens of
+ * windows away at once, so the work is put off until flushRemovals()
+ * at the end of the batch. Only what the rest of the batch might trip
+ * over is dealt with here: the client leaves the list straight away, so
+ * the taskbar, the MRU order and everything else that walks the list
+ * never see it again, and it stops being the focus or fullscreen
+ * client. */
 void
 ClientTracker::remove(ClientPointer c, int mode) {
-    auto& dm = DisplayManager::instance();
-    dm.grabServer();
-
-    // temporarily disable error handling
-    dm.setErrorHandler([](Display*, XErrorEvent*) { return 0; });
-
+    if (c->isBeingRemoved()) {
+        return;
+    }
     if constexpr (debugActive()) {
-        err("removing ", (c->getName() ? *c->getName(): ""), ", ", mode, ": ", DisplayManager::instance().getPending(), " left");
+        err("removing ", (c->getName() ? *c->getName(): ""), ", ", mode, ": ", _removals.size(), " already queued");
     }
-
-	if (mode == WITHDRAW) {
-        c->setWMState(WithdrawnState);
-	} else { //REMAP
-        dm.mapWindow(c->getWindow());
-	}
-    c->removeFromView();
+    c->setBeingRemoved();
+    _removals.emplace_back(c, mode);
     remove(c);
     if (c == _fullscreenClient) {
         _fullscreenClient.reset();
 	}
+	if (c->getWindow() == _inputFocus) {
+        _inputFocus = None;
+	}
 	if (c == _focusedClient) {
         _focusedClient.reset();
-        checkFocus(getPreviousFocused());
+        _focusRemoved = true;
 	}
+}
 
-    dm.sync(False);
-    // okay phew, reactivate it
-    dm.setErrorHandler(handleXError);
+void
+ClientTracker::flushRemovals() {
+    if (_removals.empty()) {
+        return;
+    }
+    auto& dm = DisplayManager::instance();
+    auto removals = std::move(_removals);
+    _removals.clear();
+    dm.grabServer();
+    for (auto& [c, mode] : removals) {
+        // the window may already be gone, so whatever errors this causes are expected
+        ErrorTracker::Scope scope(c->getWindow(), true);
+        ResizeSync::instance().forget(c->getWindow());
+        if (mode == WITHDRAW) {
+            c->setWMState(WithdrawnState);
+        } else { //REMAP
+            dm.mapWindow(c->getWindow());
+        }
+        c->removeFromView();
+    }
+    // pick the new focus once, from the clients that are left
+    if (std::exchange(_focusRemoved, false) && !_focusedClient) {
+        checkFocus(getPreviousFocused());
+    }
     dm.ungrabServer();
 
     Taskbar::performRedraw();
@@ -159,18 +362,18 @@ Client::redraw() noexcept {
     auto self = sharedReference();
     auto& tracker = ClientTracker::instance();
     auto& dm = DisplayManager::instance();
-    if (self == tracker.getFullscreenClient()) {
+    if (self == tracker.getFullscreenClient() || !_frame) {
         return;
     }
     drawLine(border_gc, 0, getBarHeight() - DEF_BORDERWIDTH + DEF_BORDERWIDTH / 2, _width, getBarHeight() - DEF_BORDERWIDTH + DEF_BORDERWIDTH / 2);
 	// clear text part of bar
 	if (self == tracker.getFocusedClient()) {
-        dm.fillRectangle(_frame, active_gc, 0, 0, _width - ((getBarHeight() - DEF_BORDERWIDTH) * 3), getBarHeight() - DEF_BORDERWIDTH);
+        dm.fillRectangle(_frame, active_gc, 0, 0, _width - (getTitleButtonWidth() * 3), getBarHeight() - DEF_BORDERWIDTH);
 	} else {
-        dm.fillRectangle(_frame, inactive_gc, 0, 0, _width - ((getBarHeight() - DEF_BORDERWIDTH) * 3), getBarHeight() - DEF_BORDERWIDTH);
+        dm.fillRectangle(_frame, inactive_gc, 0, 0, _width - (getTitleButtonWidth() * 3), getBarHeight() - DEF_BORDERWIDTH);
 	}
 	if (!_trans && _name) {
-        drawString(_xftdraw, &xft_detail, xftfont, SPACE, SPACE + xftfont->ascent, *(_name));
+        _frameTitle.get(xftfont, *_name, _width - (getTitleButtonWidth() * 3) - (SPACE * 2)).draw(getXftDraw(), &xft_detail, SPACE, getTextBaseline());
 	}
     auto background_gc = self == tracker.getFocusedClient() ? &active_gc : &inactive_gc;
     drawHideButton(&text_gc, background_gc);
@@ -189,7 +392,8 @@ Client::gravitate(int multiplier) noexcept {
  * use, but the others should be obvious). Our titlebar is on the top
  * so we only have to adjust in the first case. */
 	int dy = 0;
-	int gravity = (_size->flags & PWinGravity) ? _size->win_gravity : NorthWestGravity;
+    auto size = getSize();
+	int gravity = (size->flags & PWinGravity) ? size->win_gravity : NorthWestGravity;
 
 	switch (gravity) {
 		case NorthWestGravity:
@@ -215,14 +419,21 @@ Client::gravitate(int multiplier) noexcept {
  * server will paint the border in the region between the two. (I knew
  * that using X borders would get me eventually... ;-)) */
 
+/* Shaping the frame used to start with XShapeGetRectangles to see
+ * whether the client was shaped, which meant a round trip (and the
+ * client's whole rectangle list) every time the client was resized.
+ * Now we only ask once, when we take the client on, and keep track of
+ * it from ShapeNotify after that, so none of these wait on the server. */
 void
 Client::setShape() noexcept {
-	int n, order;
 	XRectangle temp;
     auto& dm = DisplayManager::instance();
 
-	auto dummy = XShapeGetRectangles(dm.getDisplay(), _window, ShapeBounding, &n, &order);
-	if (n > 1) {
+    if (!_frame) {
+        // attachFrame() will see to it
+        return;
+    }
+	if (_shaped) {
 		XShapeCombineShape(dm.getDisplay(), _frame, ShapeBounding, 0, getBarHeight(), _window, ShapeBounding, ShapeSet);
 		temp.x = -getBorderWidth();
 		temp.y = -getBorderWidth();
@@ -236,25 +447,88 @@ Client::setShape() noexcept {
 		temp2.height = getBarHeight() - getBorderWidth();
 		XShapeCombineRectangles(dm.getDisplay(), _frame, ShapeClip, 0, getBarHeight(), &temp2, 1, ShapeUnion, YXBanded);
 		_hasBeenShaped = 1;
+        _shapedWidth = _width;
 	} else {
 		if (_hasBeenShaped) {
-			// I can't find a 'remove all shaping' function...
-			temp.x = -getBorderWidth();
-			temp.y = -getBorderWidth();
-			temp.width = _width + (2 * getBorderWidth());
-			temp.height = _height + getBarHeight() + (2 * getBorderWidth());
-			XShapeCombineRectangles(dm.getDisplay(), _frame, ShapeBounding, 0, 0, &temp, 1, ShapeSet, YXBanded);
+            // a None mask takes the shape away altogether, so the frame goes back to following its own size
+            XShapeCombineMask(dm.getDisplay(), _frame, ShapeBounding, 0, 0, None, ShapeSet);
+            XShapeCombineMask(dm.getDisplay(), _frame, ShapeClip, 0, 0, None, ShapeSet);
+            _hasBeenShaped = 0;
 		}
 	}
-	XFree(dummy);
 }
 
 void
-ClientTracker::checkFocus(ClientPointer c) {
-	if (c) {
+Client::shapeChanged(const XShapeEvent& e) noexcept {
+    if (e.kind != ShapeBounding) {
+        return;
+    }
+    _shaped = e.shaped;
+    setShape();
+}
+
+/* When we resize a shaped client, only the title bar part of the frame
+ * shape depends on us: the rest is a copy of the client's own shape,
+ * which it will update (and tell us about with ShapeNotify) if it cares.
+ * So all that needs doing is widening the title bar. Shrinking needs
+ * nothing at all since the server clips the shape to the frame. */
+void
+Client::resizeShape() noexcept {
+    if (!_frame) {
+        return;
+    }
+    if (!_shaped) {
+        // unshaped frames are just rectangles and the server looks after those
+        if (_hasBeenShaped) {
+            setShape();
+        }
+        return;
+    }
+    if (_width > _shapedWidth) {
         auto& dm = DisplayManager::instance();
-        dm.setInputFocus(c->getWindow());
-        dm.installColormap(c->getColormap());
+        XRectangle bar;
+		bar.x = -getBorderWidth();
+		bar.y = -getBorderWidth();
+		bar.width = _width + (2 * getBorderWidth());
+		bar.height = getBarHeight() + getBorderWidth();
+		XShapeCombineRectangles(dm.getDisplay(), _frame, ShapeBounding, 0, 0, &bar, 1, ShapeUnion, YXBanded);
+        XRectangle clip;
+		clip.x = 0;
+		clip.y = 0;
+		clip.width = _width;
+		clip.height = getBarHeight() - getBorderWidth();
+		XShapeCombineRectangles(dm.getDisplay(), _frame, ShapeClip, 0, getBarHeight(), &clip, 1, ShapeUnion, YXBanded);
+    }
+    _shapedWidth = _width;
+}
+
+/* Focusing a client that already has the focus (clicking on it again,
+ * say) shouldn't cost anything, so we remember which window we gave the
+ * focus to and which colormap we installed, and only ask the server to
+ * change what actually needs changing. Clients can move the focus
+ * themselves, so FocusIn and FocusOut keep _inputFocus honest.
+ *
+ * ICCCM 4.1.7: a client gets the focus set on it unless its input hint
+ * says otherwise, and gets WM_TAKE_FOCUS if it asked for it; a
+ * "globally active" client gets only the latter and sets the focus
+ * wherever it likes. */
+void
+ClientTracker::checkFocus(ClientPointer c, Time time) {
+	if (c) {
+        ErrorTracker::Scope scope(c->getWindow());
+        if (_inputFocus != c->getWindow()) {
+            auto takesFocus = c->supportsProtocol(wm_take_focus);
+            if (c->acceptsInput()) {
+                setInputFocus(c->getWindow(), time);
+            } else if (!takesFocus && _inputFocus != PointerRoot) {
+                // it never takes the focus, so don't leave the keys going to whoever had it while c is drawn as focused
+                setInputFocus(PointerRoot, time);
+            }
+            if (takesFocus) {
+                sendXMessage(c->getWindow(), wm_protos, wm_take_focus, time);
+            }
+        }
+        installColormap(c->getColormap());
 	}
 	if (c != _focusedClient) {
 		ClientPointer old_focused = _focusedClient;
@@ -267,10 +541,165 @@ ClientTracker::checkFocus(ClientPointer c) {
 		if (old_focused) {
             old_focused->redraw();
 		}
-        Taskbar::performRedraw();
+        Taskbar::instance().focusChanged(old_focused, c);
 	}
 }
 
+void
+ClientTracker::setInputFocus(Window w, Time time) noexcept {
+    DisplayManager::instance().setInputFocus(w, RevertToNone, time);
+    _inputFocus = w;
+}
+
+void
+ClientTracker::installColormap(Colormap cmap) noexcept {
+    if (cmap != _installedColormap) {
+        DisplayManager::instance().installColormap(cmap);
+        _installedColormap = cmap;
+    }
+}
+
+void
+ClientTracker::focusChanged(const XFocusChangeEvent& e) noexcept {
+    // grabs don't move the focus, they only make it look like it
+    if (e.mode == NotifyGrab || e.mode == NotifyUngrab) {
+        return;
+    }
+    if (e.type == FocusIn) {
+        _inputFocus = e.window;
+    } else if (e.window == _inputFocus && e.detail != NotifyInferior) {
+        _inputFocus = None;
+    }
+}
+
+/* We only hear about colormaps being (un)installed for client windows
+ * that use them, so anything we aren't sure about just means the next
+ * install goes to the server. */
+void
+ClientTracker::colormapChanged(const XColormapEvent& e) noexcept {
+    if (e.c_new) {
+        return;
+    }
+    if ((e.state == ColormapUninstalled && e.colormap == _installedColormap) ||
+        (e.state == ColormapInstalled && e.colormap != _installedColormap)) {
+        _installedColormap = None;
+    }
+}
+
+/* Taking the old bar height out of each client's position before
+ * switching metrics and putting the new one back in afterwards keeps
+ * the top of every frame where it was. */
+void
+ClientTracker::changeMetrics(const LayoutMetrics& metrics) noexcept {
+    auto& dm = DisplayManager::instance();
+    for (auto& c : _clients) {
+        if (c != _fullscreenClient) {
+            c->gravitate(REMOVE_GRAVITY);
+        }
+    }
+    LayoutMetrics::current() = metrics;
+    for (auto& c : _clients) {
+        if (c == _fullscreenClient) {
+            continue;
+        }
+        c->gravitate(APPLY_GRAVITY);
+        if (!c->getFrame()) {
+            // it'll be put in a frame that fits when it comes back
+            continue;
+        }
+        dm.moveResizeWindow(c->getFrame(), c->getX(), c->getY() - getBarHeight(), c->getWidth(), c->getHeight() + getBarHeight());
+        dm.moveWindow(c->getWindow(), 0, getBarHeight());
+        if (shape) {
+            c->setShape();
+        }
+        c->sendConfig();
+        c->redraw();
+    }
+}
+
+/* With thousands of minimised windows, their frames and Xft contexts
+ * add up (on our side and the X server's), so clients that have been
+ * hidden for a while give them up. One timer covers every hidden
+ * client: each time it goes off it reclaims whatever is due and waits
+ * for the next one. */
+void
+ClientTracker::scheduleReclaim() noexcept {
+    if (opt_reclaim > 0 && !_reclaimScheduled) {
+        _reclaimScheduled = true;
+        addTimer(std::chrono::seconds(opt_reclaim), []() { ClientTracker::instance().reclaimHidden(); });
+    }
+}
+
+void
+ClientTracker::reclaimHidden() noexcept {
+    _reclaimScheduled = false;
+    auto now = std::chrono::steady_clock::now();
+    auto after = std::chrono::seconds(opt_reclaim);
+    std::optional<std::chrono::steady_clock::duration> next;
+    for (auto& c : _clients) {
+        if (!c->isHidden() || !c->getFrame() || c->isBeingRemoved()) {
+            continue;
+        }
+        if (auto hiddenFor = now - c->getHiddenSince(); hiddenFor >= after) {
+            c->releaseFrame();
+        } else if (!next || after - hiddenFor < *next) {
+            next = after - hiddenFor;
+        }
+    }
+    if (next) {
+        _reclaimScheduled = true;
+        addTimer(std::chrono::ceil<std::chrono::milliseconds>(*next), []() { ClientTracker::instance().reclaimHidden(); });
+    }
+}
+
+void
+ClientTracker::reportMemoryUsage() const noexcept {
+    if (_clients.empty()) {
+        return;
+    }
+    std::size_t total = 0;
+    std::size_t hidden = 0;
+    std::size_t frames = 0;
+    std::size_t draws = 0;
+    std::vector<std::tuple<std::size_t, ClientPointer>> usage;
+    for (auto& c : _clients) {
+        auto bytes = c->memoryUsage();
+        total += bytes;
+        hidden += c->isHidden() ? 1 : 0;
+        frames += c->getFrame() ? 1 : 0;
+        draws += c->hasXftDraw() ? 1 : 0;
+        usage.emplace_back(bytes, c);
+    }
+    auto [strings, stringBytes] = StringArena::instance().usage();
+    err("clients: ", _clients.size(), " managed (", hidden, " hidden), ", frames, " frames and ", draws, " Xft contexts held, ",
+            total, " bytes (", total / _clients.size(), " per client), ", strings, " titles and classes in ", stringBytes, " bytes");
+    // the heaviest few are the ones worth looking at
+    auto shown = std::min<std::size_t>(usage.size(), 5);
+    std::partial_sort(usage.begin(), usage.begin() + shown, usage.end(), [](const auto& a, const auto& b) { return std::get<0>(a) > std::get<0>(b); });
+    for (std::size_t i = 0; i < shown; ++i) {
+        auto& [bytes, c] = usage[i];
+        err("\t", bytes, " bytes: ", c->getWindow(), " ", (c->getName() ? *c->getName() : ""), c->getFrame() ? "" : " (frame released)");
+    }
+}
+
+void
+ClientTracker::switchTo(ClientPointer c) {
+    if (c->isHidden()) {
+        c->unhide();
+    } else {
+        c->raiseWindow();
+        setTopmostClient(c);
+    }
+    checkFocus(c);
+}
+
+std::vector<ClientPointer>
+ClientTracker::byRecentFocus() const {
+    std::vector<ClientPointer> clients(_clients.begin(), _clients.end());
+    std::stable_sort(clients.begin(), clients.end(), [](const ClientPointer& a, const ClientPointer& b) { return a->getFocusOrder() > b->getFocusOrder(); });
+    return clients;
+}
+
 ClientPointer
 ClientTracker::getPreviousFocused() {
 	ClientPointer prevFocused;
@@ -298,9 +727,9 @@ Client::fillRectangle(GC gc, int x, int y, unsigned int width, unsigned int heig
 }
 void
 Client::drawHideButton(GC* detail, GC* background) noexcept {
-	int x = _width - ((getBarHeight() - DEF_BORDERWIDTH) * 3);
-	int topleft_offset = (getBarHeight() / 2) - 5; // 5 being ~half of 9
-    fillRectangle(*background, x, 0, getBarHeight() - DEF_BORDERWIDTH, getBarHeight() - DEF_BORDERWIDTH);
+	int x = _width - (getTitleButtonWidth() * 3);
+	int topleft_offset = LayoutMetrics::current().getHideGlyphOffset();
+    fillRectangle(*background, x, 0, getTitleButtonWidth(), getTitleButtonWidth());
 
 
 	drawLine(detail, x + topleft_offset + 4, topleft_offset + 2, x + topleft_offset + 4, topleft_offset + 0);
@@ -316,9 +745,9 @@ Client::drawHideButton(GC* detail, GC* background) noexcept {
 
 void
 Client::drawToggleDepthButton(GC* detail, GC* background) noexcept {
-	int x = _width - ((getBarHeight() - DEF_BORDERWIDTH) * 2);
-	int topleftOffset = (getBarHeight() / 2) - 6; // 6 being ~half of 11
-    fillRectangle(*background, x, 0, getBarHeight() - DEF_BORDERWIDTH, getBarHeight() - DEF_BORDERWIDTH);
+	int x = _width - (getTitleButtonWidth() * 2);
+	int topleftOffset = LayoutMetrics::current().getDepthGlyphOffset();
+    fillRectangle(*background, x, 0, getTitleButtonWidth(), getTitleButtonWidth());
 
 	drawRectangle(*detail, x + topleftOffset, topleftOffset, 7, 7);
 	drawRectangle(*detail, x + topleftOffset + 3, topleftOffset + 3, 7, 7);
@@ -327,9 +756,9 @@ Client::drawToggleDepthButton(GC* detail, GC* background) noexcept {
 
 void
 Client::drawCloseButton(GC* detail, GC* background) noexcept {
-	int x = _width - (getBarHeight() - DEF_BORDERWIDTH);
-	int topleftOffset = (getBarHeight() / 2) - 5; // 5 being ~half of 9
-	fillRectangle(*background, x, 0, getBarHeight() - DEF_BORDERWIDTH, getBarHeight() - DEF_BORDERWIDTH);
+	int x = _width - getTitleButtonWidth();
+	int topleftOffset = LayoutMetrics::current().getCloseGlyphOffset();
+	fillRectangle(*background, x, 0, getTitleButtonWidth(), getTitleButtonWidth());
 
 	drawLine(detail, x + topleftOffset + 1, topleftOffset,     x + topleftOffset + 8, topleftOffset + 7);
 	drawLine(detail, x + topleftOffset + 1, topleftOffset + 1, x + topleftOffset + 7, topleftOffset + 7);
@@ -342,12 +771,16 @@ Client::drawCloseButton(GC* detail, GC* background) noexcept {
 
 void
 Client::raiseWindow() noexcept {
-    DisplayManager::instance().raiseWindow(_frame);
+    if (_frame) {
+        DisplayManager::instance().raiseWindow(_frame);
+    }
 }
 
 void 
 Client::lowerWindow() noexcept {
-    DisplayManager::instance().lowerWindow(_frame);
+    if (_frame) {
+        DisplayManager::instance().lowerWindow(_frame);
+    }
 }
 
 Rect
@@ -20,6 +20,7 @@
  */
 
 #include <X11/Xatom.h>
+#include <map>
 #include "windowlab.h"
 
 static void handleKeyPress(XKeyEvent&);
@@ -27,6 +28,7 @@ static void handleButtonPress(XButtonEvent&);
 static void handleWindowbarClick(XButtonEvent&, ClientPointer );
 static void handle_configure_request(XConfigureRequestEvent *);
 static void handle_map_request(XMapRequestEvent *);
+static void manageMapRequests();
 static void handle_unmap_event(XUnmapEvent *);
 static void handle_destroy_event(XDestroyWindowEvent *);
 static void handle_client_message(XClientMessageEvent *);
@@ -38,6 +40,141 @@ static void handleShapeChange(XShapeEvent&);
 
 static int interruptibleXNextEvent(XEvent *event);
 
+/* New windows wait for the end of the batch so that a burst of them
+ * can be taken on together (see Client::makeNew). */
+static std::vector<Window> mapRequests;
+
+/* Other file descriptors we wait on alongside the X connection, and
+ * what to do when each of them becomes readable. */
+static std::map<int, std::function<void()>> eventSources;
+
+void addEventSource(int fd, std::function<void()> onReadable) {
+    eventSources[fd] = onReadable;
+}
+
+void removeEventSource(int fd) {
+    eventSources.erase(fd);
+}
+
+static Time lastEventTime = CurrentTime;
+
+Time
+getLastEventTime() noexcept {
+    return lastEventTime;
+}
+
+/* Keep hold of the timestamp of anything the user did, or that the
+ * server stamped, for whatever it leads us to do. */
+static void
+noteEventTime(const XEvent& ev) noexcept {
+    switch (ev.type) {
+        case KeyPress:
+        case KeyRelease:
+            lastEventTime = ev.xkey.time;
+            break;
+        case ButtonPress:
+        case ButtonRelease:
+            lastEventTime = ev.xbutton.time;
+            break;
+        case MotionNotify:
+            lastEventTime = ev.xmotion.time;
+            break;
+        case EnterNotify:
+        case LeaveNotify:
+            lastEventTime = ev.xcrossing.time;
+            break;
+        case PropertyNotify:
+            lastEventTime = ev.xproperty.time;
+            break;
+    }
+}
+
+/* Timers, soonest first. */
+using TimerClock = std::chrono::steady_clock;
+static std::multimap<TimerClock::time_point, std::tuple<std::uint64_t, std::function<void()>>> timers;
+static std::uint64_t nextTimerId = 1;
+
+std::uint64_t addTimer(std::chrono::milliseconds delay, std::function<void()> fn) {
+    auto id = nextTimerId++;
+    timers.emplace(TimerClock::now() + delay, std::make_tuple(id, fn));
+    return id;
+}
+
+void cancelTimer(std::uint64_t id) {
+    for (auto it = timers.begin(); it != timers.end(); ++it) {
+        if (std::get<0>(it->second) == id) {
+            timers.erase(it);
+            return;
+        }
+    }
+}
+
+/* Run whatever timers are due. Returns true if any were. */
+static bool runDueTimers() {
+    auto now = TimerClock::now();
+    bool ranAny = false;
+    // a timer may add more timers, so take each one off before running it
+    while (!timers.empty() && timers.begin()->first <= now) {
+        auto fn = std::get<1>(timers.begin()->second);
+        timers.erase(timers.begin());
+        fn();
+        ranAny = true;
+    }
+    return ranAny;
+}
+
+/* Output policy: everything a handler asks for sits in Xlib's buffer
+ * until we have dealt with every event that has already arrived (a
+ * "batch"), and then goes out in one flush just before we block in
+ * select(). Nothing on the normal paths calls XSync; the only waits
+ * are for requests that need a reply anyway.
+ *
+ * To keep it that way we count, per batch, the Xlib calls that send
+ * requests (via the after function, which Xlib calls at the end of
+ * each of them) and how many of those were round trips, which we spot
+ * as the server having caught up with everything we've sent. That can
+ * occasionally count a call that only happened to find the server
+ * idle, so treat it as an upper bound. SIGUSR1 reports the totals.
+ *
+ * A client that never stops sending us events would keep the batch
+ * open forever, so a batch is also cut short after MAX_BATCH_EVENTS
+ * events or MAX_BATCH_TIME, whichever comes first. */
+static std::uint64_t eventsThisBatch = 0;
+static TimerClock::time_point batchStarted;
+static std::uint64_t requestsThisBatch = 0;
+static std::uint64_t roundTripsThisBatch = 0;
+static unsigned long lastProcessed = 0;
+
+static int countRequest(Display* dsply) {
+    ++requestsThisBatch;
+    auto processed = LastKnownRequestProcessed(dsply);
+    if (processed != lastProcessed && processed + 1 == NextRequest(dsply)) {
+        ++roundTripsThisBatch;
+    }
+    lastProcessed = processed;
+    return 0;
+}
+
+static void finishBatch() {
+    auto& dm = DisplayManager::instance();
+    ClientTracker::instance().flushRemovals();
+    manageMapRequests();
+    if (eventsThisBatch) {
+        countBatch(eventsThisBatch, requestsThisBatch, roundTripsThisBatch);
+    }
+    dm.flush();
+    WindowPrefetch::instance().speculate();
+    ErrorTracker::instance().prune();
+    eventsThisBatch = 0;
+    requestsThisBatch = 0;
+    roundTripsThisBatch = 0;
+    lastProcessed = LastKnownRequestProcessed(dm.getDisplay());
+}
+
+static bool batchFull() noexcept {
+    return eventsThisBatch >= MAX_BATCH_EVENTS || (eventsThisBatch > 0 && TimerClock::now() - batchStarted >= MAX_BATCH_TIME);
+}
+
 /* We may want to put in some sort of check for unknown events at some
  * point. TWM has an interesting and different way of doing this... */
 
@@ -45,19 +182,34 @@ void doEventLoop()
 {
 	XEvent ev;
     auto& menu = Menu::instance();
+    auto& errors = ErrorTracker::instance();
+    XSetAfterFunction(DisplayManager::instance().getDisplay(), countRequest);
 	for (;;) {
-		interruptibleXNextEvent(&ev);
-        if constexpr (debugActive()) {
-            showEvent(ev);
-        }
+        bool gotEvent = interruptibleXNextEvent(&ev);
+        errors.withdrawFailedClients();
 		/* check to see if menu rebuild has been requested */
         if (menu.shouldRepopulate()) {
             menu.populate();
+        }
+        if (statisticsReportRequested()) {
+            reportStatistics();
+        }
+        if (!gotEvent) {
+            continue;
+        }
+        ++eventsThisBatch;
+        noteEventTime(ev);
+        if constexpr (debugActive()) {
+            showEvent(ev);
         }
 		switch (ev.type) {
 			case KeyPress:
 				handleKeyPress(ev.xkey);
 				break;
+			case KeyRelease:
+                // only wanted while the taskbar has the keyboard
+                Taskbar::instance().keyRelease(ev.xkey);
+				break;
 			case ButtonPress:
 				handleButtonPress(ev.xbutton);
 				break;
@@ -67,6 +219,11 @@ void doEventLoop()
 			case MapRequest:
 				handle_map_request(&ev.xmaprequest);
 				break;
+			case CreateNotify:
+                if (ev.xcreatewindow.parent == DisplayManager::instance().getRoot() && !ev.xcreatewindow.override_redirect) {
+                    WindowPrefetch::instance().created(ev.xcreatewindow.window);
+                }
+				break;
 			case UnmapNotify:
 				handle_unmap_event(&ev.xunmap);
 				break;
@@ -79,6 +236,10 @@ void doEventLoop()
 			case ColormapNotify:
 				handle_colormap_change(&ev.xcolormap);
 				break;
+			case FocusIn:
+			case FocusOut:
+                ClientTracker::instance().focusChanged(ev.xfocus);
+				break;
 			case PropertyNotify:
 				handle_property_change(&ev.xproperty);
 				break;
@@ -91,7 +252,9 @@ void doEventLoop()
 			default:
 				if (shape && ev.type == shape_event) {
 					handleShapeChange((XShapeEvent&)ev);
-				}
+				} else {
+                    ResizeSync::instance().handleEvent(ev);
+                }
 		}
 	}
 }
@@ -101,13 +264,25 @@ static void handleKeyPress(XKeyEvent& e)
     auto& taskbar = Taskbar::instance();
     auto& clients = ClientTracker::instance();
     auto& dm = DisplayManager::instance();
+    if (taskbar.keyPress(e)) {
+        // a prompt or alt+tab has the keyboard
+        return;
+    }
     auto key = dm.keycodeToKeysym(e.keycode);
 	switch (key) {
 		case KEY_CYCLEPREV:
-            taskbar.cyclePrevious();
+            if (opt_mru) {
+                taskbar.cycleRecent(!(e.state & ShiftMask));
+            } else {
+                taskbar.cyclePrevious();
+            }
 			break;
 		case KEY_CYCLENEXT:
-            taskbar.cycleNext();
+            if (opt_mru) {
+                taskbar.cycleRecent(false);
+            } else {
+                taskbar.cycleNext();
+            }
 			break;
 		case KEY_FULLSCREEN:
             clients.toggleFullscreen();
@@ -115,6 +290,12 @@ static void handleKeyPress(XKeyEvent& e)
 		case KEY_TOGGLEZ:
             clients.getFocusedClient()->raiseLower();
 			break;
+		case KEY_LAUNCHER:
+            taskbar.launcher();
+			break;
+		case KEY_SWITCHER:
+            taskbar.switcher();
+			break;
 	}
 }
 
@@ -128,6 +309,8 @@ static void handleButtonPress(XButtonEvent& e)
     auto& taskbar = Taskbar::instance();
     auto& clients = ClientTracker::instance();
     auto& dm = DisplayManager::instance();
+    // clicking anywhere puts an end to a prompt or alt+tab
+    taskbar.cancelKeyboardGrab();
 	if (e.state & MODIFIER) {
 		if (clients.hasFocusedClient() && clients.getFocusedClient() != clients.getFullscreenClient()) {
             clients.getFocusedClient()->resize(e.x_root, e.y_root);
@@ -164,7 +347,7 @@ static void handleButtonPress(XButtonEvent& e)
 			ClientPointer c = clients.find(e.window, FRAME);
 			if (c) {
 				// click-to-focus
-                clients.checkFocus(c);
+                clients.checkFocus(c, e.time);
                 if (e.y < getBarHeight() && c != clients.getFullscreenClient()) {
                     handleWindowbarClick(e, c);
                 }
@@ -246,7 +429,7 @@ Client::boxClicked(int x) const noexcept {
     if (int pixFromRight = _width - x; pixFromRight < 0) {
         return std::numeric_limits<unsigned int>::max(); // outside window
     } else {
-        return (pixFromRight / (getBarHeight() - DEF_BORDERWIDTH));
+        return (pixFromRight / getTitleButtonWidth());
     }
 }
 void
@@ -286,8 +469,13 @@ Client::drawButton(GC *detail_gc, GC *background_gc, unsigned int which_box) noe
 static void handle_configure_request(XConfigureRequestEvent *e) {
     auto& ctracker = ClientTracker::instance();
     auto& dm = DisplayManager::instance();
+    if (std::find(mapRequests.begin(), mapRequests.end(), e->window) != mapRequests.end()) {
+        // it has to be ours before we can tell where it should go
+        manageMapRequests();
+    }
 	ClientPointer c = ctracker.find(e->window, WINDOW);
 	XWindowChanges wc;
+    ErrorTracker::Scope scope(e->window);
 
 	if (ctracker.hasFullscreenClient() && c == ctracker.getFullscreenClient()) {
         ctracker.setFullscreenPreviousDimensions(
@@ -314,32 +502,20 @@ static void handle_configure_request(XConfigureRequestEvent *e) {
 		}
         c->refixPosition(e);
         c->gravitate(APPLY_GRAVITY);
-		// configure the frame
-		wc.x = c->getX();
-		wc.y = c->getY() - getBarHeight();
-		wc.width = c->getWidth();
-		wc.height = c->getHeight()+ getBarHeight();
-		wc.border_width = DEF_BORDERWIDTH;
-		//wc.sibling = e->above;
-		//wc.stack_mode = e->detail;
-        dm.configureWindow(c->getFrame(), e->value_mask, wc);
-		if (e->value_mask & (CWWidth|CWHeight)) {
-            c->setShape();
-		}
-		c->sendConfig();
-		// start setting up the next call
-		wc.x = 0;
-		wc.y = getBarHeight();
-	} else {
-		wc.x = e->x;
-		wc.y = e->y;
+        // a client resizing itself over and over only gets as many configures as it can keep up with
+        ResizeSync::instance().configure(c, e->value_mask & (CWWidth|CWHeight), [c]() { c->applyGeometry(); });
+        return;
 	}
 
+    wc.x = e->x;
+    wc.y = e->y;
+    wc.border_width = e->border_width;
 	wc.width = e->width;
 	wc.height = e->height;
 	//wc.sibling = e->above;
 	//wc.stack_mode = e->detail;
     dm.configureWindow(e->window, e->value_mask, wc);
+    WindowPrefetch::instance().configured(e->window, e->value_mask, wc);
 }
 
 /* Two possibilities if a client is asking to be mapped. One is that
@@ -351,11 +527,19 @@ static void handle_map_request(XMapRequestEvent *e) {
 	ClientPointer c = ClientTracker::instance().find(e->window, WINDOW);
 	if (c) {
         c->unhide();
-	} else {
-        Client::makeNew(e->window);
+	} else if (std::find(mapRequests.begin(), mapRequests.end(), e->window) == mapRequests.end()) {
+        mapRequests.emplace_back(e->window);
 	}
 }
 
+static void manageMapRequests() {
+    if (!mapRequests.empty()) {
+        // a window being taken on again has to be let go of first, or the teardown would take it back out of its new frame
+        ClientTracker::instance().flushRemovals();
+        Client::makeNew(std::exchange(mapRequests, {}));
+    }
+}
+
 /* See windowlab.h for the intro to this one. If this is a window we
  * unmapped ourselves, decrement c->ignore_unmap and casually go on as
  * if nothing had happened. If the window unmapped itself from under
@@ -386,6 +570,9 @@ static void handle_unmap_event(XUnmapEvent *e) {
 
 static void handle_destroy_event(XDestroyWindowEvent *e) {
     auto& ct = ClientTracker::instance();
+    ErrorTracker::instance().windowGone(e->window);
+    mapRequests.erase(std::remove(mapRequests.begin(), mapRequests.end(), e->window), mapRequests.end());
+    WindowPrefetch::instance().forget(e->window);
 	if (auto c = ct.find(e->window, WINDOW); c) {
         ct.remove(c, WITHDRAW);
 	}
@@ -409,24 +596,88 @@ static void handle_client_message(XClientMessageEvent *e) {
 static void handle_property_change(XPropertyEvent *e) {
 	if (ClientPointer c = ClientTracker::instance().find(e->window, WINDOW); c) {
         auto& dm = DisplayManager::instance();
+        c->propertyChanged(e->atom);
+        if (e->atom == XA_WM_NAME || e->atom == net_wm_name) {
+            TitleUpdater::instance().markDirty(c);
+            return;
+        }
 		switch (e->atom) {
-            case XA_WM_NAME: {
-                                 auto [ status, opt ] = fetchName(dm.getDisplay(), c->getWindow());
-                                 (void)status; // status isn't actually used but is returned in the tuple
-                                 c->setName(opt);
-                                 c->redraw();
-                                 Taskbar::performRedraw();
-                                 break;
-                             }
-            case XA_WM_NORMAL_HINTS: {
-                                         long dummy = 0;
-                                         XGetWMNormalHints(dm.getDisplay(), c->getWindow(), c->getSize(), &dummy);
-                                         break;
-                                     }
+            case XA_WM_CLASS:
+                c->setClass(fetchClass(dm.getDisplay(), c->getWindow()));
+                Taskbar::performRedraw();
+                break;
+            case XA_WM_HINTS: {
+                                  auto group = c->getGroup();
+                                  c->updateGroup();
+                                  if (group != c->getGroup()) {
+                                      Taskbar::performRedraw();
+                                  }
+                                  break;
+                              }
+            // WM_NORMAL_HINTS are fetched again when they are next needed
 		}
+	} else {
+        WindowPrefetch::instance().propertyChanged(e->window, e->atom);
 	}
 }
 
+TitleUpdater&
+TitleUpdater::instance() noexcept {
+    static TitleUpdater _updater;
+    return _updater;
+}
+
+void
+TitleUpdater::markDirty(ClientPointer c) {
+    if (c->isTitleDirty()) {
+        // already waiting for the next frame
+        return;
+    }
+    c->setTitleDirty(true);
+    _dirty.emplace_back(c);
+    if (!_scheduled) {
+        // right away if we haven't done this for a frame, otherwise at the start of the next one
+        auto sinceLast = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - _lastFlush);
+        addTimer(std::max(TITLE_UPDATE_INTERVAL - sinceLast, std::chrono::milliseconds(0)), []() { TitleUpdater::instance().flush(); });
+        _scheduled = true;
+    }
+}
+
+void
+TitleUpdater::flush() {
+    auto& dm = DisplayManager::instance();
+    auto& taskbar = Taskbar::instance();
+    _scheduled = false;
+    _lastFlush = std::chrono::steady_clock::now();
+    auto dirty = std::move(_dirty);
+    _dirty.clear();
+    bool taskbarChanged = false;
+    for (auto& weak : dirty) {
+        auto c = weak.lock();
+        if (!c) {
+            // gone since it changed its title
+            continue;
+        }
+        c->setTitleDirty(false);
+        auto title = fetchTitle(dm.getDisplay(), c->getWindow());
+        if (c->getName() == title) {
+            continue;
+        }
+        c->setName(title);
+        auto text = title.value_or("");
+        if (c->getFrameTitle().update(text)) {
+            c->redraw();
+        }
+        // in grouped mode the label isn't the cached title, but then the redraw doesn't depend on how many clients there are either
+        if (c->getTaskbarTitle().update(text) || taskbar.grouping()) {
+            taskbarChanged = true;
+        }
+    }
+    if (taskbarChanged) {
+        taskbar.redraw();
+    }
+}
+
 /* X's default focus policy is follows-mouse, but we have to set it
  * anyway because some sloppily written clients assume that (a) they
  * can set the focus whenever they want or (b) that they don't have
@@ -460,8 +711,7 @@ static void handle_enter_event(XCrossingEvent *e) {
 		}
 
 		if (ClientPointer c = ctracker.find(e->window, FRAME); c) {
-            auto& dm = DisplayManager::instance();
-			XGrabButton(dm.getDisplay(), AnyButton, AnyModifier, c->getFrame(), False, ButtonMask, GrabModeSync, GrabModeSync, None, None);
+            c->grabButtons();
 		}
 	}
 }
@@ -476,10 +726,12 @@ static void handle_enter_event(XCrossingEvent *e) {
  * these days. */
 
 static void handle_colormap_change(XColormapEvent *e) {
-	if (ClientPointer c = ClientTracker::instance().find(e->window, WINDOW); c  && e->c_new) { // use c_new for c++
-        auto& dm = DisplayManager::instance();
+    auto& ct = ClientTracker::instance();
+	if (ClientPointer c = ct.find(e->window, WINDOW); c  && e->c_new) { // use c_new for c++
         c->setColormap(e->colormap);
-        dm.installColormap(c->getColormap());
+        ct.installColormap(c->getColormap());
+	} else {
+        ct.colormapChanged(*e);
 	}
 }
 
@@ -495,13 +747,16 @@ static void handle_expose_event(XExposeEvent *e) {
 	} else {
 		if (ClientPointer c = ClientTracker::instance().find(e->window, FRAME); c  && e->count == 0) {
             c->redraw();
+            LaunchTelemetry::instance().exposed(c);
 		}
 	}
 }
 
 static void handleShapeChange(XShapeEvent& e) {
 	if (ClientPointer c = ClientTracker::instance().find(e.window, WINDOW); c) {
-        c->setShape();
+        c->shapeChanged(e);
+	} else {
+        WindowPrefetch::instance().shapeChanged(e.window);
 	}
 }
 
@@ -515,23 +770,72 @@ static void handleShapeChange(XShapeEvent& e) {
  * implied. This program is -not- in the public domain. */
 
 /* Unlike XNextEvent, if a signal arrives, interruptibleXNextEvent will
- * return zero. */
+ * return zero. It also returns zero after running the handler for one
+ * of the other event sources, so that the caller gets a chance to look
+ * at whatever the handler changed. */
 
 static int interruptibleXNextEvent(XEvent *event) {
     auto& dm = DisplayManager::instance();
     for (int dsply_fd = dm.connectionNumber();;) {
-        if (dm.pending()) {
+        // timers get their turn even when X keeps us busy
+        if (runDueTimers()) {
+            return 0;
+        }
+        if (dm.eventsQueued() && !batchFull()) {
+            if (eventsThisBatch == 0) {
+                batchStarted = TimerClock::now();
+            }
             dm.nextEvent(event);
 			return 1;
 		}
+        // nothing left to handle (or we've handled enough for now), so this is the one place requests go out
+        finishBatch();
+        /* Writing can leave events read off the socket but not yet in
+         * Xlib's queue (they sit in XCB's buffer), and then there is
+         * nothing left on the socket for select() to wake up for. So
+         * have Xlib flush whatever the end of the batch asked for and
+         * pick those up before we wait. */
+        if (dm.eventsQueued(QueuedAfterFlush)) {
+            continue;
+        }
         fd_set fds;
 		FD_ZERO(&fds);
 		FD_SET(dsply_fd, &fds);
-		if (int rc = select(dsply_fd + 1, &fds, nullptr, nullptr, nullptr); rc < 0) {
+        int maxfd = dsply_fd;
+        for (const auto& [fd, fn] : eventSources) {
+            FD_SET(fd, &fds);
+            maxfd = std::max(maxfd, fd);
+        }
+        timeval timeout;
+        timeval* wait = nullptr;
+        if (!timers.empty()) {
+            auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(timers.begin()->first - TimerClock::now()).count();
+            remaining = std::max<decltype(remaining)>(remaining, 0);
+            timeout.tv_sec = remaining / 1000000;
+            timeout.tv_usec = remaining % 1000000;
+            wait = &timeout;
+        }
+		if (int rc = select(maxfd + 1, &fds, nullptr, nullptr, wait); rc < 0) {
 			if (errno == EINTR) {
 				return 0;
 			}
 			return 1;
-		}
+		} else if (rc == 0) {
+            // a timer is due
+            continue;
+        }
+        // copy the ready handlers out first since a handler may well remove itself
+        std::vector<std::function<void()>> ready;
+        for (const auto& [fd, fn] : eventSources) {
+            if (FD_ISSET(fd, &fds)) {
+                ready.emplace_back(fn);
+            }
+        }
+        if (!ready.empty()) {
+            for (auto& fn : ready) {
+                fn();
+            }
+            return 0;
+        }
 	}
 }
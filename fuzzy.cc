@@ -0,0 +1,176 @@
+/* WindowLab17 - An X11 window manager based off of windowlab but rewritten in C++17
+ * Based off of "WindowLab - an X11 window manager by Nick Gravgaard"
+ *
+ * WindowLab17 Copyright (c) 2020 Joshua Scoggins
+ * WindowLab Copyright (c) 2001-2010 Nick Gravgaard
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "windowlab.h"
+
+// candidates are read 16 bytes at a time, so keep that much slack after the last one
+constexpr std::size_t FUZZY_PADDING = 16;
+
+static inline char
+fold(char ch) noexcept {
+    return (ch >= 'A' && ch <= 'Z') ? static_cast<char>(ch - 'A' + 'a') : ch;
+}
+
+/* One bit for each letter and digit; everything else shares the rest. */
+static inline std::uint64_t
+characterBit(char ch) noexcept {
+    auto uch = static_cast<unsigned char>(ch);
+    if (uch >= 'a' && uch <= 'z') {
+        return std::uint64_t(1) << (uch - 'a');
+    } else if (uch >= '0' && uch <= '9') {
+        return std::uint64_t(1) << (26 + uch - '0');
+    } else {
+        return std::uint64_t(1) << (36 + (uch % 28));
+    }
+}
+
+static inline bool
+isWordBoundary(char ch) noexcept {
+    return ch == '-' || ch == '_' || ch == '.' || ch == ' ' || ch == '/' || ch == ':';
+}
+
+/* Find the first ch in [begin, end). Reading up to 15 bytes past end is
+ * fine since the text always has FUZZY_PADDING bytes after it. */
+static inline const char*
+findCharacter(const char* begin, const char* end, char ch) noexcept {
+#ifdef __SSE2__
+    auto needle = _mm_set1_epi8(ch);
+    for (; begin < end; begin += 16) {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        unsigned int hits = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if (auto remaining = end - begin; remaining < 16) {
+            hits &= (1u << remaining) - 1;
+        }
+        if (hits) {
+            return begin + __builtin_ctz(hits);
+        }
+    }
+    return end;
+#else
+    for (; begin < end; ++begin) {
+        if (*begin == ch) {
+            return begin;
+        }
+    }
+    return end;
+#endif
+}
+
+/* Score a candidate against an already folded query, greedily taking
+ * the first occurrence of each query character. Matches at the start of
+ * the candidate or of a word, and runs of consecutive characters, score
+ * well; gaps and left over characters cost a little. */
+static std::optional<int>
+scoreCandidate(const char* entry, const char* end, std::string_view query) noexcept {
+    int score = 0;
+    const char* pos = entry;
+    const char* previous = nullptr;
+    for (auto ch : query) {
+        auto hit = findCharacter(pos, end, ch);
+        if (hit == end) {
+            return std::nullopt;
+        }
+        if (hit == entry) {
+            score += 16;
+        } else if (isWordBoundary(hit[-1])) {
+            score += 12;
+        }
+        if (previous && hit == previous + 1) {
+            score += 10;
+        } else {
+            score -= static_cast<int>(std::min<std::ptrdiff_t>(hit - pos, 8));
+        }
+        previous = hit;
+        pos = hit + 1;
+    }
+    score -= static_cast<int>(std::min<std::ptrdiff_t>((end - entry) - query.size(), 16));
+    return score;
+}
+
+void
+FuzzyIndex::clear() noexcept {
+    _text.clear();
+    _offsets.clear();
+    _masks.clear();
+}
+
+void
+FuzzyIndex::reserve(std::size_t count, std::size_t bytes) {
+    _text.reserve(bytes + FUZZY_PADDING);
+    _offsets.reserve(count + 1);
+    _masks.reserve(count);
+}
+
+void
+FuzzyIndex::add(std::string_view text) {
+    // drop the padding from the end of the last entry before adding this one
+    if (!_offsets.empty()) {
+        _text.resize(_offsets.back());
+    } else {
+        _offsets.emplace_back(0);
+    }
+    std::uint64_t mask = 0;
+    for (auto ch : text) {
+        auto folded = fold(ch);
+        _text.push_back(folded);
+        mask |= characterBit(folded);
+    }
+    _offsets.emplace_back(_text.size());
+    _masks.emplace_back(mask);
+    _text.append(FUZZY_PADDING, '\0');
+}
+
+std::vector<FuzzyIndex::Match>
+FuzzyIndex::search(std::string_view query, std::size_t limit) const {
+    std::vector<Match> matches;
+    if (query.empty()) {
+        for (std::uint32_t i = 0; i < size() && matches.size() < limit; ++i) {
+            matches.push_back({ 0, i });
+        }
+        return matches;
+    }
+    std::string folded;
+    std::uint64_t wanted = 0;
+    for (auto ch : query) {
+        folded.push_back(fold(ch));
+        wanted |= characterBit(folded.back());
+    }
+    const char* text = _text.data();
+    for (std::uint32_t i = 0; i < size(); ++i) {
+        if ((_masks[i] & wanted) != wanted) {
+            continue;
+        }
+        if (auto score = scoreCandidate(text + _offsets[i], text + _offsets[i + 1], folded); score) {
+            matches.push_back({ *score, i });
+        }
+    }
+    auto better = [](const Match& a, const Match& b) { return a.score != b.score ? a.score > b.score : a.index < b.index; };
+    if (matches.size() > limit) {
+        std::nth_element(matches.begin(), matches.begin() + limit, matches.end(), better);
+        matches.resize(limit);
+    }
+    std::sort(matches.begin(), matches.end(), better);
+    return matches;
+}
@@ -0,0 +1,485 @@
+/* WindowLab17 - An X11 window manager based off of windowlab but rewritten in C++17
+ * Based off of "WindowLab - an X11 window manager by Nick Gravgaard"
+ *
+ * WindowLab17 Copyright (c) 2020 Joshua Scoggins
+ * WindowLab Copyright (c) 2001-2010 Nick Gravgaard
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <fstream>
+#include <iomanip>
+#include <X11/Xatom.h>
+#include "windowlab.h"
+
+extern char** environ;
+
+/* Launching things from the menu used to fork() the whole window
+ * manager, which gets slower the more memory we have mapped, and then
+ * left us reaping the children from a signal handler. Instead we fork
+ * one small helper process right at the start, before we have opened
+ * the display or grown at all, and send it the commands to run over a
+ * pipe. The helper starts them with posix_spawn and lets the kernel
+ * reap them by ignoring SIGCHLD, so none of that touches the window
+ * manager any more. If the helper goes away for whatever reason we fall
+ * back to forking ourselves. */
+
+LaunchService&
+LaunchService::instance() noexcept {
+    static LaunchService _service;
+    return _service;
+}
+
+static bool
+readFully(int fd, void* buf, std::size_t len) noexcept {
+    auto ptr = static_cast<char*>(buf);
+    while (len > 0) {
+        auto count = read(fd, ptr, len);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+        ptr += count;
+        len -= count;
+    }
+    return true;
+}
+
+std::string
+LaunchService::startupId(std::uint32_t id) noexcept {
+    // the helper is our child, so this is the window manager's pid from in there too
+    static pid_t wm = getpid();
+    return "windowlab-" + std::to_string(wm) + "-" + std::to_string(id) + "_TIME0";
+}
+
+/* Each request is the launch id, the length of the command and then
+ * the command itself. The helper answers with the launch id and the
+ * pid it started, which is how the telemetry finds out about it. */
+[[noreturn]] static void
+runHelper(int requests, int replies) noexcept {
+    // none of the window manager's signal handling applies in here
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGCHLD, SIG_IGN);
+
+    auto envShell = getEnvironmentVariable("SHELL", "/bin/sh");
+    auto envShellName = std::filesystem::path(envShell).filename().string();
+    if (envShellName.empty()) {
+        envShellName = envShell;
+    }
+
+    // children should start with a clean slate rather than our ignored SIGCHLD
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t defaults, empty;
+    sigemptyset(&empty);
+    sigfillset(&defaults);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, &empty);
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+#ifdef POSIX_SPAWN_SETSID
+    flags |= POSIX_SPAWN_SETSID;
+#endif
+    posix_spawnattr_setflags(&attr, flags);
+
+    // everything from our environment apart from any startup id, which we set per launch
+    std::vector<char*> env;
+    for (char** var = environ; *var; ++var) {
+        if (strncmp(*var, "DESKTOP_STARTUP_ID=", 19) != 0) {
+            env.emplace_back(*var);
+        }
+    }
+    env.emplace_back(nullptr);
+    env.emplace_back(nullptr);
+
+    for (;;) {
+        std::uint32_t id = 0;
+        std::uint32_t len = 0;
+        if (!readFully(requests, &id, sizeof id) || !readFully(requests, &len, sizeof len)) {
+            // the window manager has gone away
+            _exit(0);
+        }
+        std::string cmd(len, '\0');
+        if (!readFully(requests, cmd.data(), len)) {
+            _exit(0);
+        }
+        char* argv[] = { envShellName.data(), const_cast<char*>("-c"), cmd.data(), nullptr };
+        std::string startupVar = "DESKTOP_STARTUP_ID=" + LaunchService::startupId(id);
+        env[env.size() - 2] = startupVar.data();
+        pid_t pid = -1;
+        if (auto rc = posix_spawnp(&pid, envShell.c_str(), nullptr, &attr, argv, env.data()); rc != 0) {
+            err("can't launch ", cmd, ": ", strerror(rc));
+            pid = -1;
+        }
+        char reply[sizeof id + sizeof pid];
+        memcpy(reply, &id, sizeof id);
+        memcpy(reply + sizeof id, &pid, sizeof pid);
+        (void)write(replies, reply, sizeof reply);
+    }
+}
+
+void
+LaunchService::start() noexcept {
+    int fds[2];
+    int replyFds[2];
+    if (pipe(fds) != 0) {
+        err("can't create pipe for the launch helper: ", strerror(errno));
+        return;
+    }
+    if (pipe(replyFds) != 0) {
+        err("can't create pipe for the launch helper: ", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return;
+    }
+    (void)startupId(0); // make sure it has our pid before we fork
+    switch (pid_t pid = fork(); pid) {
+        case 0:
+            close(fds[1]);
+            close(replyFds[0]);
+            setsid();
+            runHelper(fds[0], replyFds[1]);
+        case -1:
+            err("can't fork launch helper");
+            close(fds[0]);
+            close(fds[1]);
+            close(replyFds[0]);
+            close(replyFds[1]);
+            break;
+        default:
+            close(fds[0]);
+            close(replyFds[1]);
+            // don't leak the pipes into anything we fork ourselves, and never block the event loop on them
+            fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+            fcntl(fds[1], F_SETFL, O_NONBLOCK);
+            fcntl(replyFds[0], F_SETFD, FD_CLOEXEC);
+            fcntl(replyFds[0], F_SETFL, O_NONBLOCK);
+            _helper = pid;
+            _requests = fds[1];
+            _replies = replyFds[0];
+            addEventSource(_replies, []() { LaunchService::instance().readReplies(); });
+            break;
+    }
+}
+
+void
+LaunchService::readReplies() noexcept {
+    std::uint32_t id;
+    pid_t pid;
+    char reply[sizeof id + sizeof pid];
+    // replies are smaller than PIPE_BUF so they always arrive whole
+    for (;;) {
+        auto count = read(_replies, reply, sizeof reply);
+        if (count == 0) {
+            // the helper has gone
+            removeEventSource(_replies);
+            close(_replies);
+            _replies = -1;
+            return;
+        }
+        if (count != sizeof reply) {
+            return;
+        }
+        memcpy(&id, reply, sizeof id);
+        memcpy(&pid, reply + sizeof id, sizeof pid);
+        LaunchTelemetry::instance().spawned(id, pid);
+    }
+}
+
+bool
+LaunchService::launch(std::uint32_t id, const std::string& cmd) noexcept {
+    if (_requests == -1) {
+        return false;
+    }
+    // send it as one write so that it goes through atomically or not at all
+    std::string message(sizeof(std::uint32_t) * 2, '\0');
+    std::uint32_t len = cmd.size();
+    memcpy(message.data(), &id, sizeof id);
+    memcpy(message.data() + sizeof id, &len, sizeof len);
+    message += cmd;
+    if (message.size() > PIPE_BUF) {
+        // too long to be sure of going through whole
+        return false;
+    }
+    if (write(_requests, message.data(), message.size()) != static_cast<ssize_t>(message.size())) {
+        if (errno == EPIPE) {
+            err("launch helper has gone away, launching directly from now on");
+            close(_requests);
+            _requests = -1;
+        }
+        return false;
+    }
+    return true;
+}
+
+LaunchTelemetry&
+LaunchTelemetry::instance() noexcept {
+    static LaunchTelemetry _telemetry;
+    return _telemetry;
+}
+
+// launches that haven't produced a window in this long probably never will (or not one we can match up)
+constexpr auto LAUNCH_TIMEOUT = std::chrono::minutes(2);
+// and we don't want to keep track of an unbounded number of them
+constexpr std::size_t MAX_PENDING_LAUNCHES = 64;
+
+std::uint32_t
+LaunchTelemetry::launched(const std::string& cmd) noexcept {
+    expire();
+    if (_pending.size() >= MAX_PENDING_LAUNCHES) {
+        _pending.erase(_pending.begin());
+    }
+    auto id = _nextId++;
+    _pending.push_back({ id, cmd, Clock::now() });
+    ++_statistics[cmd].launches;
+    return id;
+}
+
+void
+LaunchTelemetry::spawned(std::uint32_t id, pid_t pid) noexcept {
+    for (auto& launch : _pending) {
+        if (launch.id == id) {
+            launch.pid = pid;
+            return;
+        }
+    }
+}
+
+void
+LaunchTelemetry::expire() noexcept {
+    auto now = Clock::now();
+    _pending.erase(std::remove_if(_pending.begin(), _pending.end(), [now](const Pending& p) { return now - p.launchedAt > LAUNCH_TIMEOUT; }), _pending.end());
+}
+
+/* Look up the parent of a process in /proc. */
+static pid_t
+parentOf(pid_t pid) noexcept {
+    std::ifstream statFile("/proc/" + std::to_string(pid) + "/stat");
+    std::string stat;
+    std::getline(statFile, stat);
+    if (auto commEnd = stat.rfind(')'); commEnd != std::string::npos) {
+        std::istringstream fields(stat.substr(commEnd + 2));
+        std::string state;
+        pid_t ppid = -1;
+        if (fields >> state >> ppid) {
+            return ppid;
+        }
+    }
+    return -1;
+}
+
+static std::optional<std::string>
+getStringProperty(Window w, Atom property) noexcept {
+	Atom realType;
+	int realFormat;
+	unsigned long itemsRead, itemsLeft;
+	unsigned char *data = nullptr;
+    std::optional<std::string> result;
+    if (DisplayManager::instance().getWindowProperty(w, property, 0L, 64L, False, AnyPropertyType, &realType, &realFormat, &itemsRead, &itemsLeft, &data) == Success && data) {
+        if (realFormat == 8) {
+            result.emplace(reinterpret_cast<char*>(data), itemsRead);
+        }
+        XFree(data);
+    }
+    return result;
+}
+
+static std::optional<pid_t>
+getPidProperty(Window w) noexcept {
+	Atom realType;
+	int realFormat;
+	unsigned long itemsRead, itemsLeft;
+	unsigned char *data = nullptr;
+    std::optional<pid_t> result;
+    if (DisplayManager::instance().getWindowProperty(w, net_wm_pid, 0L, 1L, False, XA_CARDINAL, &realType, &realFormat, &itemsRead, &itemsLeft, &data) == Success && data) {
+        if (itemsRead && realFormat == 32) {
+            result = static_cast<pid_t>(*reinterpret_cast<long*>(data));
+        }
+        XFree(data);
+    }
+    return result;
+}
+
+void
+LaunchTelemetry::mapped(ClientPointer c) noexcept {
+    expire();
+    // only go asking the client about itself if there is something it could match
+    if (std::none_of(_pending.begin(), _pending.end(), [](const Pending& p) { return p.window == None; })) {
+        return;
+    }
+    auto match = _pending.end();
+    if (auto startup = getStringProperty(c->getWindow(), net_startup_id); startup) {
+        match = std::find_if(_pending.begin(), _pending.end(), [&startup](const Pending& p) { return p.window == None && *startup == LaunchService::startupId(p.id); });
+    }
+    if (match == _pending.end()) {
+        if (auto pid = getPidProperty(c->getWindow()); pid) {
+            // the shell may well have forked rather than exec'd, so work our way up the process tree
+            for (int depth = 0; depth < 8 && *pid > 1 && match == _pending.end(); ++depth, *pid = parentOf(*pid)) {
+                match = std::find_if(_pending.begin(), _pending.end(), [pid](const Pending& p) { return p.window == None && p.pid == *pid; });
+            }
+        }
+    }
+    if (match != _pending.end()) {
+        std::chrono::duration<double, std::milli> elapsed = Clock::now() - match->launchedAt;
+        _statistics[match->command].toMapRequest.add(elapsed.count());
+        match->window = c->getWindow();
+        if constexpr (debugActive()) {
+            err(match->command, " mapped after ", elapsed.count(), "ms");
+        }
+    }
+}
+
+void
+LaunchTelemetry::exposed(ClientPointer c) noexcept {
+    if (auto match = std::find_if(_pending.begin(), _pending.end(), [&c](const Pending& p) { return p.window == c->getWindow(); }); match != _pending.end()) {
+        std::chrono::duration<double, std::milli> elapsed = Clock::now() - match->launchedAt;
+        _statistics[match->command].toExpose.add(elapsed.count());
+        _pending.erase(match);
+        publish();
+        save();
+    }
+}
+
+void
+LaunchTelemetry::Samples::add(double value) noexcept {
+    if (values.size() < WINDOW_SIZE) {
+        values.emplace_back(value);
+    } else {
+        values[next] = value;
+    }
+    next = (next + 1) % WINDOW_SIZE;
+}
+
+std::tuple<double, double, double>
+LaunchTelemetry::Samples::summarise() const noexcept {
+    if (values.empty()) {
+        return std::make_tuple(0.0, 0.0, 0.0);
+    }
+    double sum = 0.0;
+    for (auto value : values) {
+        sum += value;
+    }
+    auto [min, max] = std::minmax_element(values.begin(), values.end());
+    return std::make_tuple(sum / values.size(), *min, *max);
+}
+
+std::string
+LaunchTelemetry::report() const noexcept {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    for (const auto& [command, stats] : _statistics) {
+        auto [mapMean, mapMin, mapMax] = stats.toMapRequest.summarise();
+        auto [exposeMean, exposeMin, exposeMax] = stats.toExpose.summarise();
+        out << command << ": launches " << stats.launches
+            << ", map request mean " << mapMean << "ms min " << mapMin << "ms max " << mapMax << "ms"
+            << ", first expose mean " << exposeMean << "ms min " << exposeMin << "ms max " << exposeMax << "ms"
+            << " (last " << stats.toMapRequest.values.size() << ")\n";
+    }
+    return out.str();
+}
+
+void
+LaunchTelemetry::publish() noexcept {
+    auto text = report();
+    auto& dm = DisplayManager::instance();
+    dm.changeProperty(dm.getRoot(), wl_launch_stats, utf8_string, 8, PropModeReplace, reinterpret_cast<unsigned char*>(text.data()), text.size());
+}
+
+static std::filesystem::path
+getLaunchStatsPath() noexcept {
+    return getCacheDirectory() / "launch.stats";
+}
+
+constexpr std::uint32_t LAUNCH_STATS_MAGIC = 0x534c4c57; // "WLLS"
+constexpr std::uint32_t LAUNCH_STATS_VERSION = 1;
+
+static void
+writeSamples(std::ostream& out, const std::vector<double>& values) noexcept {
+    writeCacheValue<std::uint32_t>(out, values.size());
+    for (auto value : values) {
+        writeCacheValue(out, value);
+    }
+}
+
+static bool
+readSamples(std::istream& in, std::vector<double>& values, std::size_t limit) noexcept {
+    std::uint32_t count = 0;
+    if (!readCacheValue(in, count) || count > limit) {
+        return false;
+    }
+    values.resize(count);
+    for (auto& value : values) {
+        if (!readCacheValue(in, value)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void
+LaunchTelemetry::save() const noexcept {
+    std::error_code ec;
+    std::filesystem::create_directories(getCacheDirectory(), ec);
+    auto tmpPath = getLaunchStatsPath();
+    tmpPath += ".tmp";
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        return;
+    }
+    writeCacheValue(out, LAUNCH_STATS_MAGIC);
+    writeCacheValue(out, LAUNCH_STATS_VERSION);
+    writeCacheValue<std::uint32_t>(out, _statistics.size());
+    for (const auto& [command, stats] : _statistics) {
+        writeCacheString(out, command);
+        writeCacheValue(out, stats.launches);
+        writeSamples(out, stats.toMapRequest.values);
+        writeSamples(out, stats.toExpose.values);
+    }
+    out.close();
+    if (out) {
+        std::filesystem::rename(tmpPath, getLaunchStatsPath(), ec);
+    }
+}
+
+void
+LaunchTelemetry::load() noexcept {
+    std::ifstream in(getLaunchStatsPath(), std::ios::binary);
+    std::uint32_t magic = 0, version = 0, count = 0;
+    if (!readCacheValue(in, magic) || magic != LAUNCH_STATS_MAGIC ||
+        !readCacheValue(in, version) || version != LAUNCH_STATS_VERSION ||
+        !readCacheValue(in, count)) {
+        return;
+    }
+    for (std::uint32_t i = 0; i < count; ++i) {
+        std::string command;
+        Statistics stats;
+        if (!readCacheString(in, command) || !readCacheValue(in, stats.launches) ||
+            !readSamples(in, stats.toMapRequest.values, WINDOW_SIZE) ||
+            !readSamples(in, stats.toExpose.values, WINDOW_SIZE)) {
+            return;
+        }
+        stats.toMapRequest.next = stats.toMapRequest.values.size() % WINDOW_SIZE;
+        stats.toExpose.next = stats.toExpose.values.size() % WINDOW_SIZE;
+        _statistics[command] = std::move(stats);
+    }
+    publish();
+}
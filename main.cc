@@ -21,16 +21,22 @@
 
 #include <string.h>
 #include <signal.h>
+#include <time.h>
+#include <chrono>
+#include <fstream>
+#include <thread>
+#include <fontconfig/fontconfig.h>
 #include <X11/cursorfont.h>
 #include "windowlab.h"
 
 XFontStruct *font = nullptr;
 XftFont *xftfont = nullptr;
 XftColor xft_detail;
-GC string_gc, border_gc, text_gc, active_gc, depressed_gc, inactive_gc, menu_gc, selected_gc, empty_gc;
+GC string_gc, outline_gc, border_gc, text_gc, active_gc, depressed_gc, inactive_gc, menu_gc, selected_gc, empty_gc;
 XColor border_col, text_col, active_col, depressed_col, inactive_col, menu_col, selected_col, empty_col;
 Cursor resize_curs;
-Atom wm_state, wm_change_state, wm_protos, wm_delete, wm_cmapwins;
+Atom wm_state, wm_change_state, wm_protos, wm_delete, wm_cmapwins, wm_take_focus;
+Atom net_wm_pid, net_startup_id, utf8_string, wl_launch_stats, net_wm_name, net_wm_sync_request, net_wm_sync_request_counter;
 std::string opt_font = DEF_FONT;
 std::string opt_border = DEF_BORDER;
 std::string opt_text = DEF_TEXT;
@@ -40,11 +46,24 @@ std::string opt_menu = DEF_MENU;
 std::string opt_selected = DEF_SELECTED;
 std::string opt_empty = DEF_EMPTY;
 std::string opt_display;
+bool opt_progressive = false;
+bool opt_mru = false;
+bool opt_outline = false;
+int opt_reclaim = DEF_RECLAIM;
 Bool shape;
 int shape_event = 0;
+LayoutMetrics LayoutMetrics::_current;
 
 static void scanWindows(void);
 static void setup_display(void);
+static double msSinceExec() noexcept;
+static void openFont();
+static void startResourceLoader();
+static void resourcesReady();
+// state for progressive startup, see startResourceLoader()
+static int resourcesReadyPipe[2] = { -1, -1 };
+static std::thread resourceLoader;
+static Menu::Contents loadedMenu;
 
 int main(int argc, char **argv) {
 	for (int i = 1; i < argc; i++) {
@@ -64,6 +83,22 @@ int main(int argc, char **argv) {
 		X("-empty", opt_empty)
 		X("-display", opt_display)
 #undef X
+        if (currArg == "-progressive") {
+            opt_progressive = true;
+            continue;
+        }
+        if (currArg == "-mru") {
+            opt_mru = true;
+            continue;
+        }
+        if (currArg == "-outline") {
+            opt_outline = true;
+            continue;
+        }
+        if (currArg == "-reclaim" && (i + 1 < argc)) {
+            opt_reclaim = std::max(0, std::atoi(argv[++i]));
+            continue;
+        }
         if (currArg == "-about") {
             std::cout << "WindowLab17 " << VERSION << "(" << RELEASEDATE << ")" << std::endl;;
             std::cout << "WindowLab Original Code, Copyright (c) 2001-2009 Nick Gravgaard" << std::endl;
@@ -74,9 +109,12 @@ int main(int argc, char **argv) {
 			exit(0);
         }
 		// shouldn't get here; must be a bad option
-		err("usage:\n  windowlab [options]\n\noptions are:\n  -font <font>\n  -border|-text|-active|-inactive|-menu|-selected|-empty <color>\n  -about\n  -display <display>");
+		err("usage:\n  windowlab [options]\n\noptions are:\n  -font <font>\n  -border|-text|-active|-inactive|-menu|-selected|-empty <color>\n  -progressive\n  -mru\n  -outline\n  -reclaim <seconds>\n  -about\n  -display <display>");
 		return 2;
 	}
+    // this has to happen before we open the display or set up any signal handlers
+    LaunchService::instance().start();
+    signal(SIGPIPE, SIG_IGN);
     struct sigaction act;
 	act.sa_handler = signalHandler;
 	act.sa_flags = 0;
@@ -84,32 +122,137 @@ int main(int argc, char **argv) {
 	sigaction(SIGINT, &act, nullptr);
 	sigaction(SIGHUP, &act, nullptr);
 	sigaction(SIGCHLD, &act, nullptr);
+	sigaction(SIGUSR1, &act, nullptr);
 
+    if (opt_progressive) {
+        // get fontconfig and the menu going before we even open the display
+        startResourceLoader();
+    }
+    using Clock = std::chrono::steady_clock;
+    auto msBetween = [](Clock::time_point start, Clock::time_point end) { return std::chrono::duration<double, std::milli>(end - start).count(); };
+    auto startedMain = Clock::now();
 	setup_display();
-    Menu::instance().populate();
+    LaunchTelemetry::instance().load();
+    auto displayReady = Clock::now();
+    if (!opt_progressive) {
+        Menu::instance().populate();
+    }
+    auto menuReady = Clock::now();
+    if (opt_progressive) {
+        addEventSource(resourcesReadyPipe[0], resourcesReady);
+    }
     // exploit the side effects
     Taskbar::instance().make();
 	scanWindows();
+    WindowPool::instance().prime();
+    auto desktopReady = Clock::now();
+    recordStartupTiming("managed desktop ready ", msSinceExec(), "ms after exec (display setup ", msBetween(startedMain, displayReady),
+        "ms, menu ", msBetween(displayReady, menuReady), "ms, taskbar and existing windows ", msBetween(menuReady, desktopReady), "ms)");
 	doEventLoop();
 	return 0; // just another brick in the -Wall
 }
 
+static void
+openFont() {
+    auto& dm = DisplayManager::instance();
+	xftfont = XftFontOpenXlfd(dm.getDisplay(), dm.getDefaultScreen(), opt_font.c_str());
+	if (!xftfont) {
+        err("font '", opt_font, "' not found");
+		exit(1);
+	}
+}
+
+/* Progressive startup. Opening the font can take hundreds of
+ * milliseconds when fontconfig's cache is cold, and until we are in
+ * the event loop any new windows just sit there unmanaged. So instead
+ * we take over the root window straight away with a guessed bar height
+ * while another thread warms up fontconfig by matching our font and
+ * reads the menu file. Neither of those touch X, so the thread needs
+ * no locking on the display. Once it is done it pokes a pipe and the
+ * event loop calls resourcesReady(), which opens the font (quick now
+ * that fontconfig has done the hard part) and fixes up the
+ * decorations. */
+
+static void
+startResourceLoader() {
+    if (pipe(resourcesReadyPipe) != 0) {
+        err("can't create pipe for progressive startup, falling back to normal startup");
+        opt_progressive = false;
+        return;
+    }
+    resourceLoader = std::thread([]() {
+        FcInit();
+        if (auto pattern = XftXlfdParse(opt_font.c_str(), False, False); pattern) {
+            FcConfigSubstitute(nullptr, pattern, FcMatchPattern);
+            FcDefaultSubstitute(pattern);
+            FcResult result;
+            if (auto match = FcFontMatch(nullptr, pattern, &result); match) {
+                FcPatternDestroy(match);
+            }
+            FcPatternDestroy(pattern);
+        }
+        loadedMenu = Menu::load();
+        char done = 1;
+        (void)write(resourcesReadyPipe[1], &done, 1);
+    });
+}
+
+static void
+resourcesReady() {
+    char done;
+    (void)read(resourcesReadyPipe[0], &done, 1);
+    resourceLoader.join();
+    removeEventSource(resourcesReadyPipe[0]);
+    close(resourcesReadyPipe[0]);
+    close(resourcesReadyPipe[1]);
+
+    openFont();
+    ClientTracker::instance().changeMetrics(LayoutMetrics(xftfont->ascent, xftfont->descent));
+    Taskbar::instance().resize();
+    if (auto& menu = Menu::instance(); !menu.install(std::move(loadedMenu))) {
+        // the menu has been reloaded since, without a font to lay it out with
+        menu.measure();
+    }
+    Taskbar::performRedraw();
+    recordStartupTiming("decorations ready ", msSinceExec(), "ms after exec");
+}
+
 static void
 scanWindows() {
 	unsigned int nwins = 0;
 	Window dummyw1, dummyw2, *wins;
-	XWindowAttributes attr;
     auto& dm = DisplayManager::instance();
     dm.queryTree(&dummyw1, &dummyw2, &wins, &nwins);
-	for (unsigned int i = 0; i < nwins; i++) {
-        dm.getWindowAttributes(wins[i], attr);
-		if (!attr.override_redirect && attr.map_state == IsViewable) {
-            Client::makeNew(wins[i]);
-		}
-	}
+    Client::makeNew(std::vector<Window>(wins, wins + nwins), true);
 	XFree(wins);
 }
 
+/* How long ago the kernel started this process. Timing from the start of
+ * main() would miss the dynamic loader and static initialisation, and
+ * what we really care about is how long it is from exec until the
+ * desktop is usable. The start time is only as precise as a clock
+ * tick, which is good enough for this. */
+static double
+msSinceExec() noexcept {
+    std::ifstream statFile("/proc/self/stat");
+    std::string stat;
+    std::getline(statFile, stat);
+    // the command name can contain spaces, so start counting fields after it
+    if (auto commEnd = stat.rfind(')'); commEnd != std::string::npos) {
+        std::istringstream fields(stat.substr(commEnd + 2));
+        std::string field;
+        // starttime is field 22 overall, which is field 20 once pid and comm are dropped
+        for (int i = 0; i < 20 && fields >> field; ++i) { }
+        if (fields) {
+            timespec now;
+            clock_gettime(CLOCK_BOOTTIME, &now);
+            auto startedAt = (std::stod(field) * 1000.0) / sysconf(_SC_CLK_TCK);
+            return ((now.tv_sec * 1000.0) + (now.tv_nsec / 1000000.0)) - startedAt;
+        }
+    }
+    return 0.0;
+}
+
 DisplayManager& 
 DisplayManager::instance() noexcept {
     static bool _mustInit = true;
@@ -136,27 +279,42 @@ static void setup_display() {
     auto& dm = DisplayManager::instance();
 
     dm.setErrorHandler(handleXError);
-	wm_state = dm.internAtom("WM_STATE", False);
-	wm_change_state = dm.internAtom("WM_CHANGE_STATE", False);
-	wm_protos = dm.internAtom("WM_PROTOCOLS", False);
-	wm_delete = dm.internAtom("WM_DELETE_WINDOW", False);
-	wm_cmapwins = dm.internAtom("WM_COLORMAP_WINDOWS", False);
-	dm.allocNamedColorFromDefaultColormap(opt_border, border_col);
-	dm.allocNamedColorFromDefaultColormap(opt_text, text_col);
-	dm.allocNamedColorFromDefaultColormap(opt_active, active_col);
-	dm.allocNamedColorFromDefaultColormap(opt_inactive, inactive_col);
-	dm.allocNamedColorFromDefaultColormap(opt_menu, menu_col);
-	dm.allocNamedColorFromDefaultColormap(opt_selected, selected_col);
-	dm.allocNamedColorFromDefaultColormap(opt_empty, empty_col);
-
-	depressed_col.pixel = active_col.pixel;
+    // one round trip for all of the atoms instead of one each
+    auto atoms = dm.internAtoms({ "WM_STATE", "WM_CHANGE_STATE", "WM_PROTOCOLS", "WM_DELETE_WINDOW", "WM_COLORMAP_WINDOWS",
+                                  "_NET_WM_PID", "_NET_STARTUP_ID", "UTF8_STRING", "_WINDOWLAB_LAUNCH_STATS", "_NET_WM_NAME", "WM_TAKE_FOCUS",
+                                  "_NET_WM_SYNC_REQUEST", "_NET_WM_SYNC_REQUEST_COUNTER" });
+	wm_state = atoms[0];
+	wm_change_state = atoms[1];
+	wm_protos = atoms[2];
+	wm_delete = atoms[3];
+	wm_cmapwins = atoms[4];
+    net_wm_pid = atoms[5];
+    net_startup_id = atoms[6];
+    utf8_string = atoms[7];
+    wl_launch_stats = atoms[8];
+    net_wm_name = atoms[9];
+    wm_take_focus = atoms[10];
+    net_wm_sync_request = atoms[11];
+    net_wm_sync_request_counter = atoms[12];
+    for (auto [spec, col] : { std::make_tuple(&opt_border, &border_col),
+                              std::make_tuple(&opt_text, &text_col),
+                              std::make_tuple(&opt_active, &active_col),
+                              std::make_tuple(&opt_inactive, &inactive_col),
+                              std::make_tuple(&opt_menu, &menu_col),
+                              std::make_tuple(&opt_selected, &selected_col),
+                              std::make_tuple(&opt_empty, &empty_col) }) {
+        if (!dm.resolveColor(*spec, *col)) {
+            err("can't find colour '", *spec, "'");
+        }
+    }
+
 	depressed_col.red = active_col.red - ACTIVE_SHADOW;
 	depressed_col.green = active_col.green - ACTIVE_SHADOW;
 	depressed_col.blue = active_col.blue - ACTIVE_SHADOW;
 	depressed_col.red = depressed_col.red <= (USHRT_MAX - ACTIVE_SHADOW) ? depressed_col.red : 0;
 	depressed_col.green = depressed_col.green <= (USHRT_MAX - ACTIVE_SHADOW) ? depressed_col.green : 0;
 	depressed_col.blue = depressed_col.blue <= (USHRT_MAX - ACTIVE_SHADOW) ? depressed_col.blue : 0;
-    dm.allocColorFromDefaultColormap(depressed_col);
+    dm.resolvePixel(depressed_col);
 
 	xft_detail.color.red = text_col.red;
 	xft_detail.color.green = text_col.green;
@@ -164,21 +322,29 @@ static void setup_display() {
 	xft_detail.color.alpha = 0xffff;
 	xft_detail.pixel = text_col.pixel;
 
-	xftfont = XftFontOpenXlfd(dm.getDisplay(), dm.getDefaultScreen(), opt_font.c_str());
-	if (!xftfont) {
-        err("font '", opt_font, "' not found");
-		exit(1);
-	}
+    if (opt_progressive) {
+        // draw the frames at a guessed size until resourcesReady() gets the real font
+        LayoutMetrics::current() = LayoutMetrics(PROVISIONAL_FONT_ASCENT, PROVISIONAL_FONT_DESCENT);
+    } else {
+        openFont();
+        LayoutMetrics::current().update(xftfont);
+    }
 
 	shape = XShapeQueryExtension(dm.getDisplay(), &shape_event, &dummy);
+    ResizeSync::instance().init();
 
 	resize_curs = XCreateFontCursor(dm.getDisplay(), XC_fleur);
 
 	/* find out which modifier is NumLock - we'll use this when grabbing every combination of modifiers we can think of */
+	/* and which keys make up MODIFIER, so the MRU switcher can tell when it is let go */
     auto modmap = dm.getModifierMapping();
+    auto numLockKeycode = XKeysymToKeycode(dm.getDisplay(), XK_Num_Lock);
 	for (auto i = 0; i < 8; i++) {
 		for (auto j = 0; j < modmap->max_keypermod; j++) {
-			if (modmap->modifiermap[i * modmap->max_keypermod + j] == XKeysymToKeycode(dm.getDisplay(), XK_Num_Lock)) {
+            if (auto keycode = modmap->modifiermap[i * modmap->max_keypermod + j]; keycode && (1 << i) == MODIFIER) {
+                dm.addModifierKeycode(keycode);
+            }
+			if (modmap->modifiermap[i * modmap->max_keypermod + j] == numLockKeycode) {
                 dm.setNumLockMask((1 << i));
                 if constexpr (debugActive()) {
                     std::cerr << "setup_display() : XK_Num_lock is (1<<0x" << i << ")" << std::endl;
@@ -218,6 +384,12 @@ static void setup_display() {
 	gv.foreground = empty_col.pixel;
 	empty_gc = dm.createGCForRoot(GCFunction|GCForeground, gv);
 
+	// drawn straight onto the root, over the top of whatever windows are there
+	gv.function = GXxor;
+	gv.foreground = XWhitePixel(dm.getDisplay(), dm.getDefaultScreen()) ^ XBlackPixel(dm.getDisplay(), dm.getDefaultScreen());
+	gv.subwindow_mode = IncludeInferiors;
+	outline_gc = dm.createGCForRoot(GCFunction|GCForeground|GCLineWidth|GCSubwindowMode, gv);
+
 	sattr.event_mask = ChildMask|ColormapChangeMask|ButtonMask;
 	XChangeWindowAttributes(dm.getDisplay(), dm.getRoot(), CWEventMask, &sattr);
 
@@ -225,7 +397,10 @@ static void setup_display() {
 	dm.grabKeysym(MODIFIER, KEY_CYCLENEXT);
 	dm.grabKeysym(MODIFIER, KEY_FULLSCREEN);
 	dm.grabKeysym(MODIFIER, KEY_TOGGLEZ);
-}
-int getBarHeight() noexcept {
-    return (xftfont->ascent + xftfont->descent + 2 * SPACE + 2);
+	dm.grabKeysym(MODIFIER, KEY_LAUNCHER);
+	dm.grabKeysym(MODIFIER, KEY_SWITCHER);
+    if (opt_mru) {
+        // shift reverses the direction of the MRU switcher
+        dm.grabKeysym(MODIFIER|ShiftMask, KEY_CYCLEPREV);
+    }
 }
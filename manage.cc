@@ -42,6 +42,7 @@ Client::hide() noexcept {
     if (!_hidden) {
         ++_ignoreUnmap;
         _hidden = true;
+        _hiddenSince = std::chrono::steady_clock::now();
         auto& ct = ClientTracker::instance();
         auto& dm = DisplayManager::instance();
         if (sharedReference() == ct.getTopmostClient()) {
@@ -51,6 +52,7 @@ Client::hide() noexcept {
         dm.unmapWindow(_window);
         setWMState(IconicState);
         ct.checkFocus(ct.getPreviousFocused());
+        ct.scheduleReclaim();
     }
 }
 
@@ -61,6 +63,11 @@ Client::unhide() noexcept {
         auto& ct = ClientTracker::instance();
         auto& dm = DisplayManager::instance();
         ct.setTopmostClient(sharedReference());
+        if (!_frame) {
+            ErrorTracker::Scope scope(_window);
+            attachFrame();
+            sendConfig();
+        }
         dm.mapWindow(_window);
         dm.mapRaised(_frame);
         setWMState(NormalState);
@@ -74,11 +81,10 @@ ClientTracker::toggleFullscreen() noexcept {
     auto& dm = DisplayManager::instance();
     auto& tbar = Taskbar::instance();
 	if (c  && !c->getTrans()) {
+        auto& sync = ResizeSync::instance();
         if (c == getFullscreenClient()) { // reset to original size
             c->setDimensions(getFullscreenPreviousDimensions());
-            dm.moveResizeWindow(c->getFrame(), c->getX(), c->getY() - getBarHeight(), c->getWidth(), c->getHeight() + getBarHeight());
-            dm.moveResizeWindow(c->getWidth(), 0, getBarHeight(), c->getWidth(), c->getHeight());
-            c->sendConfig();
+            sync.configure(c, true, [c]() { c->applyGeometry(); });
             setFullscreenClient(nullptr);
             tbar.setShowingTaskbar(true);
 		} else { // make fullscreen
@@ -86,11 +92,9 @@ ClientTracker::toggleFullscreen() noexcept {
             int yoffset = 0;
             int maxwinwidth = dm.getWidth();
             int maxwinheight = dm.getHeight() - getBarHeight();
-			if (hasFullscreenClient()) { // reset existing fullscreen window to original size
-                getFullscreenClient()->setDimensions(getFullscreenPreviousDimensions());
-				dm.moveResizeWindow(getFullscreenClient()->getFrame(), getFullscreenClient()->getX(), getFullscreenClient()->getY() - getBarHeight(), getFullscreenClient()->getWidth(), getFullscreenClient()->getHeight()+ getBarHeight());
-				dm.moveResizeWindow(getFullscreenClient()->getWindow(), 0, getBarHeight(), getFullscreenClient()->getWidth(), getFullscreenClient()->getHeight());
-                getFullscreenClient()->sendConfig();
+			if (auto previous = getFullscreenClient(); previous) { // reset existing fullscreen window to original size
+                previous->setDimensions(getFullscreenPreviousDimensions());
+                sync.configure(previous, true, [previous]() { previous->applyGeometry(); });
 			}
 
             setFullscreenPreviousDimensions(c->getRect());
@@ -109,9 +113,12 @@ ClientTracker::toggleFullscreen() noexcept {
 					yoffset = (maxwinheight - c->getHeight()) / 2;
 				}
 			}
-			dm.moveResizeWindow(c->getFrame(), c->getX(), c->getY(), maxwinwidth, maxwinheight);
-			dm.moveResizeWindow(c->getWindow(), xoffset, yoffset, c->getWidth(), c->getHeight());
-            c->sendConfig();
+            sync.configure(c, true, [c, xoffset, yoffset, maxwinwidth, maxwinheight]() {
+                auto& dm = DisplayManager::instance();
+                dm.moveResizeWindow(c->getFrame(), c->getX(), c->getY(), maxwinwidth, maxwinheight);
+                dm.moveResizeWindow(c->getWindow(), xoffset, yoffset, c->getWidth(), c->getHeight());
+                c->sendConfig();
+            });
             setFullscreenClient(c);
             tbar.setShowingTaskbar(tbar.insideTaskbar());
 		}
@@ -124,19 +131,9 @@ ClientTracker::toggleFullscreen() noexcept {
  * prejudice. */
 void
 Client::sendWMDelete() noexcept {
-	int n = 0;
-    int found = 0;
     auto& dm = DisplayManager::instance();
-	if (Atom* protocols = nullptr; XGetWMProtocols(dm.getDisplay(), _window, &protocols, &n)) {
-		for (int i = 0; i < n; i++) {
-			if (protocols[i] == wm_delete) {
-				++found;
-			}
-		}
-		XFree(protocols);
-	}
-	if (found) {
-        sendXMessage(_window, wm_protos, wm_delete);
+	if (supportsProtocol(wm_delete)) {
+        sendXMessage(_window, wm_protos, wm_delete, getLastEventTime());
 	} else {
         dm.killClient(_window);
 	}
@@ -146,7 +143,6 @@ Client::move() noexcept {
 	XEvent ev;
 	int old_cx = _x;
 	int old_cy = _y;
-	XSetWindowAttributes pattr;
     auto& dm = DisplayManager::instance();
     auto& ct = ClientTracker::instance();
     auto [dw, dh] = dm.getDimensions();
@@ -156,36 +152,98 @@ Client::move() noexcept {
     auto bdw = (dw - bdx - (getWidth() - bdx)) + 1;
     auto bdh = ((dh - bdy - (getHeight() - bdy)) + 1) + (getHeight() - ((getBarHeight() * 2) - DEF_BORDERWIDTH));
     Rect bounddims(bdx, bdy, bdw, bdh);
-    auto constraint_win = dm.createWindow(bounddims, 0, CopyFromParent, InputOnly, CopyFromParent, 0, pattr);
+    auto& pool = WindowPool::instance();
+    auto constraint_win = pool.acquire(PooledWindow::Constraint, bounddims);
     if constexpr (debugActive()) {
         std::cerr << "Client::move() : constraint_win is (" << bounddims.getX() << ", " << bounddims.getY() << ")-(" << (bounddims.getX() + bounddims.getWidth()) << ", " << (bounddims.getY() + bounddims.getHeight()) << ")" << std::endl;
     }
     dm.mapWindow(constraint_win);
 
 	if (!(dm.grabPointer(false, MouseMask, GrabModeAsync, GrabModeAsync, constraint_win, None, CurrentTime) == GrabSuccess)) {
-        dm.destroyWindow(constraint_win);
+        pool.release(PooledWindow::Constraint, constraint_win);
 		return;
 	}
 
+    /* Moving a big window, or one whose client is slow to redraw, makes
+     * the client re-layout and everything underneath repaint for every
+     * step. Those are moved as an outline instead, under a server grab
+     * so nothing draws over it, and the frame is only moved at the end.
+     * How far behind the pointer a real move has got is measured by
+     * comparing the motion events' server timestamps with our clock. */
+    using Clock = std::chrono::steady_clock;
+    bool outline = opt_outline || _moveOutline ||
+        static_cast<long>(_width) * (_height + getBarHeight()) * 100 > static_cast<long>(dw) * dh * OUTLINE_MOVE_MIN_AREA_PERCENT;
+    if (outline) {
+        dm.grabServer();
+        drawOutline(_x, _y);
+    }
+    std::optional<std::tuple<Time, Clock::time_point>> firstMotion;
 	do {
 		dm.maskEvent(ExposureMask|MouseMask, ev);
 		switch (ev.type) {
 			case Expose:
 				if (ClientPointer exposed_c = ct.find(ev.xexpose.window, FRAME); exposed_c) {
+                    // the outline is XORed over the frames too, so take it off while the frame is painted over
+                    if (outline) {
+                        drawOutline(_x, _y);
+                    }
                     exposed_c->redraw();
+                    if (outline) {
+                        drawOutline(_x, _y);
+                    }
 				}
 				break;
 			case MotionNotify:
+                if (outline) {
+                    drawOutline(_x, _y);
+                }
 				_x = old_cx + (ev.xmotion.x - mousex);
 				_y = old_cy + (ev.xmotion.y - mousey);
+                if (outline) {
+                    drawOutline(_x, _y);
+                    break;
+                }
                 dm.moveWindow(_frame, _x, _y - getBarHeight());
                 sendConfig();
+                if (!firstMotion) {
+                    firstMotion.emplace(ev.xmotion.time, Clock::now());
+                } else {
+                    auto [serverStart, start] = *firstMotion;
+                    auto serverElapsed = std::chrono::milliseconds(static_cast<std::uint32_t>(ev.xmotion.time - serverStart));
+                    if (auto lag = (Clock::now() - start) - serverElapsed; lag > OUTLINE_MOVE_LAG) {
+                        if constexpr (debugActive()) {
+                            err("moving ", *_name, " is ", std::chrono::duration_cast<std::chrono::milliseconds>(lag).count(), "ms behind, switching to an outline");
+                        }
+                        _moveOutline = true;
+                        outline = true;
+                        dm.grabServer();
+                        drawOutline(_x, _y);
+                    }
+                }
 				break;
 		}
 	} while (ev.type != ButtonRelease);
 
+    if (outline) {
+        drawOutline(_x, _y);
+        dm.ungrabServer();
+        dm.moveWindow(_frame, _x, _y - getBarHeight());
+        sendConfig();
+    }
     dm.ungrab();
-    dm.destroyWindow(constraint_win);
+    pool.release(PooledWindow::Constraint, constraint_win);
+}
+
+void
+Client::drawOutline(int x, int y) noexcept {
+    auto& dm = DisplayManager::instance();
+    auto top = y - getBarHeight();
+    auto outerWidth = _width + (2 * getBorderWidth());
+    auto outerHeight = _height + getBarHeight() + (2 * getBorderWidth());
+    dm.drawRectangle(dm.getRoot(), outline_gc, x, top, outerWidth - 1, outerHeight - 1);
+    // the bottom of the title bar, stopping short of the sides so no pixel is XORed twice
+    auto barBottom = top + getBorderWidth() + getBarHeight() - DEF_BORDERWIDTH;
+    dm.drawLine(dm.getRoot(), outline_gc, x + 1, barBottom, x + outerWidth - 2, barBottom);
 }
 
 void 
@@ -193,7 +251,6 @@ Client::resize(int x, int y) {
 	XEvent ev;
 	ClientPointer exposed_c;
 	Window resize_win, resizebar_win;
-	XSetWindowAttributes pattr, resize_pattr, resizebar_pattr;
     auto& ct = ClientTracker::instance();
     auto& dm = DisplayManager::instance();
     // inside the window, dragging outwards : TRUE
@@ -206,33 +263,25 @@ Client::resize(int x, int y) {
 
     Rect bounddims { 0, 0, static_cast<int>(dw), static_cast<int>(dh) };
 
-	auto constraint_win = dm.createWindow(bounddims, 0, CopyFromParent, InputOnly, CopyFromParent, 0, pattr);
+    auto& pool = WindowPool::instance();
+	auto constraint_win = pool.acquire(PooledWindow::Constraint, bounddims);
     dm.mapWindow(constraint_win);
 
 	if (!(dm.grabPointer(false, MouseMask, GrabModeAsync, GrabModeAsync, constraint_win, resize_curs, CurrentTime) == GrabSuccess)) {
-        dm.destroyWindow(constraint_win);
+        pool.release(PooledWindow::Constraint, constraint_win);
 		return;
 	}
     Rect newdims { _x, _y - getBarHeight(), _width, _height + getBarHeight() };
     Rect recalceddims(newdims);
 
-	// create and map resize window
-	resize_pattr.override_redirect = True;
-	resize_pattr.background_pixel = menu_col.pixel;
-	resize_pattr.border_pixel = border_col.pixel;
-	resize_pattr.event_mask = ChildMask|ButtonPressMask|ExposureMask|EnterWindowMask;
-    resize_win = dm.createWindow(newdims, DEF_BORDERWIDTH, dm.getDefaultDepth(), CopyFromParent, dm.getDefaultVisual(), CWOverrideRedirect|CWBackPixel|CWBorderPixel|CWEventMask, resize_pattr);
+	// get and map resize window
+    resize_win = pool.acquire(PooledWindow::ResizeOutline, newdims);
+    resizebar_win = pool.getResizeBar(resize_win);
+    dm.moveResizeWindow(resizebar_win, -DEF_BORDERWIDTH, -DEF_BORDERWIDTH, newdims.getWidth(), getBarHeight() - DEF_BORDERWIDTH);
     dm.mapRaised(resize_win);
 
-	resizebar_pattr.override_redirect = True;
-	resizebar_pattr.background_pixel = active_col.pixel;
-	resizebar_pattr.border_pixel = border_col.pixel;
-	resizebar_pattr.event_mask = ChildMask|ButtonPressMask|ExposureMask|EnterWindowMask;
-    resizebar_win = dm.createWindow(resize_win, -DEF_BORDERWIDTH, -DEF_BORDERWIDTH, newdims.getWidth(), getBarHeight() - DEF_BORDERWIDTH, DEF_BORDERWIDTH, DefaultDepth(DisplayManager::instance().getDisplay(), DisplayManager::instance().getScreen()), CopyFromParent, DefaultVisual(DisplayManager::instance().getDisplay(), DisplayManager::instance().getScreen()), CWOverrideRedirect|CWBackPixel|CWBorderPixel|CWEventMask, resizebar_pattr);
-    dm.mapRaised(resizebar_win);
-
 	// temporarily swap drawables in order to draw on the resize window's XFT context
-	XftDrawChange(_xftdraw, (Drawable) resizebar_win);
+	XftDrawChange(getXftDraw(), (Drawable) resizebar_win);
 
 	// hide real window's frame
     dm.unmapWindow(_frame);
@@ -354,21 +403,17 @@ Client::resize(int x, int y) {
 	dm.ungrab();
     setDimensions(recalceddims.getX(), recalceddims.getY() + getBarHeight(),
             recalceddims.getWidth(), recalceddims.getHeight() - getBarHeight());
-    dm.moveResizeWindow(_frame, _x, _y - getBarHeight(), _width, _height + getBarHeight());
-    dm.resizeWindow(_window, _width, _height);
+    ResizeSync::instance().configure(sharedReference(), true, [c = sharedReference()]() { c->applyGeometry(); });
 
 	// unhide real window's frame
     dm.mapWindow(_frame);
-    dm.setInputFocus(_window); 
-
-    sendConfig();
-    dm.destroyWindow(constraint_win);
+    ct.setInputFocus(_window, getLastEventTime());
+    pool.release(PooledWindow::Constraint, constraint_win);
 
 	// reset the drawable
-	XftDrawChange(_xftdraw, static_cast<Drawable>(_frame));
+	XftDrawChange(getXftDraw(), static_cast<Drawable>(_frame));
 	
-    dm.destroyWindow(resizebar_win);
-    dm.destroyWindow(resize_win);
+    pool.release(PooledWindow::ResizeOutline, resize_win);
 }
 
 static void limit_size(ClientPointer c, Rect *newdims)
@@ -424,6 +469,6 @@ static bool get_incsize(ClientPointer c, unsigned int *x_ret, unsigned int *y_re
 void 
 Client::writeTitleText(Window /* barWin */) noexcept {
    if (!_trans && _name) {
-       drawString(_xftdraw, &xft_detail, xftfont, SPACE, SPACE + xftfont->ascent, *_name);
+       _frameTitle.get(xftfont, *_name, _width - (getTitleButtonWidth() * 3) - (SPACE * 2)).draw(getXftDraw(), &xft_detail, SPACE, getTextBaseline());
    }
 }
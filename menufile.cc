@@ -19,6 +19,7 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <sys/inotify.h>
 #include "windowlab.h"
 #include <cerrno>
 #include <iostream>
@@ -28,11 +29,12 @@
 #include <optional>
 #include <string>
 #include <algorithm>
+#include <atomic>
 
 // semaphor activated by SIGHUP
 bool doMenuItems = false;
-
-XGlyphInfo extents;
+// the generation of the most recent load(), which may be running on the resource loader thread
+static std::atomic<std::uint64_t> latestLoad { 0 };
 
 const std::filesystem::path& getDefMenuRc() noexcept {
     static std::filesystem::path _menu(DEF_MENURC);
@@ -83,29 +85,55 @@ std::optional<std::tuple<std::string, std::string>> parseLine(const std::string&
     }
     return std::nullopt;
 }
+/* The places we look for the menurc file, in order of preference. */
+static std::vector<std::filesystem::path>
+candidatePaths() noexcept {
+    std::vector<std::filesystem::path> paths { getHomeDirectory() / ".windowlab/windowlab.menurc" };
+    std::error_code ec;
+    std::filesystem::path exePath = std::filesystem::read_symlink("/proc/self/exe", ec);
+    if (ec) {
+        err("readlink() /proc/self/exe failed: %s\n", ec.message().c_str());
+        exePath = ".";
+    } 
+    exePath = exePath.remove_filename();
+    /// @todo make sure that this path only adds the ../.. if it makes sense (there are / in the string)
+    paths.emplace_back(exePath / "../../etc/windowlab.menurc");
+    paths.emplace_back(getDefMenuRc());
+    return paths;
+}
+
+static std::filesystem::path
+getMenuCachePath() noexcept {
+    return getCacheDirectory() / "menu.cache";
+}
+
 void
 Menu::populate() noexcept {
-    clear();
-    std::filesystem::path menurcpath = getHomeDirectory() / ".windowlab/windowlab.menurc";
-    std::ifstream menufile(menurcpath);
-    if (!menufile.is_open()) {
-        std::error_code ec;
-        menurcpath = std::filesystem::read_symlink("/proc/self/exe", ec);
-        if (ec) {
-            err("readlink() /proc/self/exe failed: %s\n", ec.message().c_str());
-            menurcpath = ".";
-        } 
-        menurcpath = menurcpath.remove_filename();
-        /// @todo make sure that this path only adds the ../.. if it makes sense (there are / in the string)
-        menurcpath /= "../../etc/windowlab.menurc";
-        menufile.close();
-        menufile.open(menurcpath);
-        if (!menufile.is_open()) {
-            menufile.close();
-            menufile.open(getDefMenuRc());
+    install(load());
+}
+
+Menu::Contents
+Menu::load() noexcept {
+    Contents contents;
+    contents.generation = ++latestLoad;
+    std::ifstream menufile;
+    auto candidates = candidatePaths();
+    for (const auto& path : candidates) {
+        menufile.open(path);
+        if (menufile.is_open()) {
+            contents.source = path;
+            break;
         }
+        menufile.clear();
     }
     if (menufile.is_open()) {
+        std::error_code ec;
+        auto modified = std::filesystem::last_write_time(contents.source, ec);
+        contents.modified = ec ? 0 : modified.time_since_epoch().count();
+        contents.size = std::filesystem::file_size(contents.source, ec);
+        if (loadCache(contents)) {
+            return contents;
+        }
         std::string currentLine;
         while (std::getline(menufile, currentLine)) {
             if (!currentLine.empty()) {
@@ -113,24 +141,186 @@ Menu::populate() noexcept {
                 trimLeadingWs(line);
                 if (!line.empty() && (line.front() != '#')) {
                     if (auto parsed = parseLine(line); parsed) {
-                        _menuItems.emplace_back(std::make_shared<MenuItem>(std::get<0>(*parsed), std::get<1>(*parsed)));
+                        contents.items.emplace_back(std::make_shared<MenuItem>(std::get<0>(*parsed), std::get<1>(*parsed)));
                     }
                 }
             }
         }
     } else {
-		err("can't find ~/.windowlab/windowlab.menurc, ", menurcpath, " or ", getDefMenuRc());
-        _menuItems.emplace_back(std::make_shared<MenuItem>(NO_MENU_LABEL, NO_MENU_COMMAND));
+		err("can't find ", candidates[0], ", ", candidates[1], " or ", candidates[2]);
+        contents.items.emplace_back(std::make_shared<MenuItem>(NO_MENU_LABEL, NO_MENU_COMMAND));
     }
     menufile.close();
+    return contents;
+}
+
+bool
+Menu::install(Contents&& contents) noexcept {
+    if (contents.generation != latestLoad) {
+        // e.g. the progressive startup loader finishing after a SIGHUP reload has been and gone
+        return false;
+    }
+    _menuItems = std::move(contents.items);
+    _source = contents.source;
+    _modified = contents.modified;
+    _size = contents.size;
+    measure();
+    watchSources();
+	// menu items have been built
+    _updateMenuItems = 0;
+    return true;
+}
+
+void
+Menu::measure() noexcept {
+    if (!xftfont) {
+        // progressive startup hasn't got the font yet; we'll be called again once it arrives
+        return;
+    }
+    bool measuredAnything = false;
     unsigned int buttonStartX = 0;
     for (auto& menuItem : _menuItems) {
         menuItem->setX(buttonStartX);
-		XftTextExtents8(DisplayManager::instance().getDisplay(), xftfont, (unsigned char *)menuItem->getLabel().data(), menuItem->getLabel().size(), &extents);
-        menuItem->setWidth(extents.width + (SPACE * 4));
+        if (menuItem->getWidth() == 0) {
+            menuItem->setWidth(textWidth(xftfont, menuItem->getLabel()) + (SPACE * 4));
+            measuredAnything = true;
+        }
         buttonStartX += menuItem->getWidth()+ 1;
 	}
-	// menu items have been built
-    _updateMenuItems = false;
+    if (measuredAnything) {
+        saveCache();
+    }
 }
 
+std::size_t
+Menu::itemAt(int x) const noexcept {
+    // the items are laid out left to right, so find the last one that starts at or before x
+    auto loc = std::upper_bound(_menuItems.begin(), _menuItems.end(), x, [](int x, const auto& item) { return x < item->getX(); });
+    if (loc == _menuItems.begin()) {
+        return size();
+    }
+    --loc;
+    if (x > (*loc)->getX() + (*loc)->getWidth()) {
+        return size();
+    }
+    return std::distance(_menuItems.begin(), loc);
+}
+
+/* Reload the menu whenever any of the files we could have read it
+ * from changes, including one earlier in the search order appearing.
+ * We watch the directories rather than the files themselves because
+ * most editors save by writing a new file and renaming it over the old
+ * one, which a watch on the file wouldn't survive. Where a directory
+ * doesn't exist (yet), we watch the nearest one above it that does and
+ * move the watch down as the directories on the way are made. */
+void
+Menu::watchSources() noexcept {
+    auto& watcher = FileWatcher::instance();
+    for (auto wd : _watches) {
+        watcher.unwatch(wd);
+    }
+    _watches.clear();
+    for (const auto& path : candidatePaths()) {
+        auto dir = path.parent_path();
+        auto name = path.filename().string();
+        std::error_code ec;
+        while (!std::filesystem::is_directory(dir, ec) && dir.has_relative_path()) {
+            name = dir.filename().string();
+            dir = dir.parent_path();
+        }
+        bool atFile = dir == path.parent_path();
+        auto wd = watcher.watchDirectory(dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF,
+                [path, name, atFile](const std::string& changed) {
+                    auto& menu = Menu::instance();
+                    if (changed.empty()) {
+                        // the directory itself has gone, so start again from whatever is left
+                        menu.watchSources();
+                    } else if (changed != name) {
+                        return;
+                    } else if (atFile) {
+                        menu.requestMenuItemUpdate();
+                    } else {
+                        menu.watchSources();
+                        // the file can be written before the watch gets down to it
+                        if (std::error_code ec; std::filesystem::exists(path, ec)) {
+                            menu.requestMenuItemUpdate();
+                        }
+                    }
+                });
+        if (wd != -1) {
+            _watches.emplace_back(wd);
+        }
+    }
+}
+
+/* The menu cache holds the parsed items along with their widths in
+ * pixels, so that when nothing has changed we can skip both parsing
+ * the menurc file and measuring the labels. It is only good for the
+ * file and font it was made from:
+ *
+ * magic, version, font, source path, source mtime, source size, count,
+ * then (label, command, width) for each item. */
+constexpr std::uint32_t MENU_CACHE_MAGIC = 0x434d4c57; // "WLMC"
+constexpr std::uint32_t MENU_CACHE_VERSION = 2;
+
+bool
+Menu::loadCache(Contents& contents) noexcept {
+    std::ifstream cache(getMenuCachePath(), std::ios::binary);
+    std::uint32_t magic = 0, version = 0, count = 0;
+    std::string font, source;
+    std::int64_t modified = 0;
+    std::uintmax_t size = 0;
+    if (!readCacheValue(cache, magic) || magic != MENU_CACHE_MAGIC ||
+        !readCacheValue(cache, version) || version != MENU_CACHE_VERSION ||
+        !readCacheString(cache, font) || font != opt_font ||
+        !readCacheString(cache, source) || source != contents.source.string() ||
+        !readCacheValue(cache, modified) || modified != contents.modified ||
+        !readCacheValue(cache, size) || size != contents.size ||
+        !readCacheValue(cache, count)) {
+        return false;
+    }
+    Items items;
+    for (std::uint32_t i = 0; i < count; ++i) {
+        std::string label, command;
+        std::int32_t width = 0;
+        if (!readCacheString(cache, label) || !readCacheString(cache, command) || !readCacheValue(cache, width)) {
+            return false;
+        }
+        items.emplace_back(std::make_shared<MenuItem>(label, command, 0, width));
+    }
+    contents.items = std::move(items);
+    return true;
+}
+
+void
+Menu::saveCache() const noexcept {
+    if (_source.empty()) {
+        // the fallback menu didn't come from anywhere
+        return;
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(getCacheDirectory(), ec);
+    // write it somewhere else first so a crash can't leave half a cache behind
+    auto tmpPath = getMenuCachePath();
+    tmpPath += ".tmp";
+    std::ofstream cache(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!cache.is_open()) {
+        return;
+    }
+    writeCacheValue(cache, MENU_CACHE_MAGIC);
+    writeCacheValue(cache, MENU_CACHE_VERSION);
+    writeCacheString(cache, opt_font);
+    writeCacheString(cache, _source.string());
+    writeCacheValue(cache, _modified);
+    writeCacheValue(cache, _size);
+    writeCacheValue<std::uint32_t>(cache, _menuItems.size());
+    for (const auto& item : _menuItems) {
+        writeCacheString(cache, item->getLabel());
+        writeCacheString(cache, item->getCommand());
+        writeCacheValue<std::int32_t>(cache, item->getWidth());
+    }
+    cache.close();
+    if (cache) {
+        std::filesystem::rename(tmpPath, getMenuCachePath(), ec);
+    }
+}
@@ -24,6 +24,7 @@
 #include <unistd.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <X11/Xatom.h>
 #include "windowlab.h"
 #include <optional>
 #include <string>
@@ -48,18 +49,26 @@ getEnvironmentVariable(const std::string& varName, const std::string& defaultVal
 }
 
 void forkExec(const std::string& cmd) {
+    auto& telemetry = LaunchTelemetry::instance();
+    auto id = telemetry.launched(cmd);
+    if (LaunchService::instance().launch(id, cmd)) {
+        return;
+    }
 	pid_t pid = fork();
 
 	switch (pid) {
   		case 0:
             {
                 setsid();
+                // the window manager ignores SIGPIPE, and ignored signals stay ignored across exec
+                signal(SIGPIPE, SIG_DFL);
                 auto envShell = getEnvironmentVariable("SHELL", "/bin/sh");
                 std::filesystem::path envShellPath(envShell);
                 auto envShellName = envShellPath.filename();
                 if (envShellName.empty()) {
                     envShellName = envShell;
                 }
+                setenv("DESKTOP_STARTUP_ID", LaunchService::startupId(id).c_str(), 1);
 
                 execlp(envShell.c_str(), envShellName.c_str(), "-c", cmd.c_str(), nullptr);
                 err("exec failed, cleaning up child");
@@ -69,6 +78,9 @@ void forkExec(const std::string& cmd) {
 		case -1:
 			err("can't fork");
 			break;
+        default:
+            telemetry.spawned(id, pid);
+            break;
 	}
 }
 
@@ -84,7 +96,11 @@ void signalHandler(int signal)
 			quitNicely();
 			break;
 		case SIGHUP:
-            Menu::instance().populate();
+            // the event loop picks this up; it isn't safe to touch X from in here
+            Menu::instance().requestMenuItemUpdate();
+			break;
+		case SIGUSR1:
+            requestStatisticsReport();
 			break;
 		case SIGCHLD:
 			while ((pid = waitpid(-1, &status, WNOHANG)) != 0) {
@@ -98,30 +114,166 @@ void signalHandler(int signal)
 	}
 }
 
+static volatile sig_atomic_t statisticsRequested = 0;
+static std::array<std::uint64_t, static_cast<std::size_t>(CachedProperty::Count)> propertyHits {};
+static std::array<std::uint64_t, static_cast<std::size_t>(CachedProperty::Count)> propertyMisses {};
+
+void
+countPropertyLookup(CachedProperty property, bool hit) noexcept {
+    ++(hit ? propertyHits : propertyMisses)[static_cast<std::size_t>(property)];
+}
+
+static std::vector<std::string> startupLines;
+
+void
+recordStartupLine(const std::string& line) noexcept {
+    if constexpr (debugActive()) {
+        err(line);
+    }
+    startupLines.emplace_back(line);
+}
+
+static std::uint64_t batches = 0;
+static std::uint64_t batchEvents = 0;
+static std::uint64_t batchRequests = 0;
+static std::uint64_t batchRoundTrips = 0;
+static std::uint64_t worstBatchRoundTrips = 0;
+
+void
+countBatch(std::uint64_t events, std::uint64_t requests, std::uint64_t roundTrips) noexcept {
+    ++batches;
+    batchEvents += events;
+    batchRequests += requests;
+    batchRoundTrips += roundTrips;
+    worstBatchRoundTrips = std::max(worstBatchRoundTrips, roundTrips);
+}
+
+void
+requestStatisticsReport() noexcept {
+    statisticsRequested = 1;
+}
+
+bool
+statisticsReportRequested() noexcept {
+    return statisticsRequested;
+}
+
+void
+reportStatistics() noexcept {
+    statisticsRequested = 0;
+    for (const auto& line : startupLines) {
+        err("startup: ", line);
+    }
+    constexpr const char* names[] = { "WM_STATE", "WM_PROTOCOLS", "WM_HINTS", "WM_NORMAL_HINTS" };
+    for (std::size_t i = 0; i < propertyHits.size(); ++i) {
+        auto total = propertyHits[i] + propertyMisses[i];
+        err("property cache: ", names[i], " ", propertyHits[i], " hits, ", propertyMisses[i], " misses",
+                total ? " (" + std::to_string(propertyHits[i] * 100 / total) + "% hit)" : std::string());
+    }
+    if (batches) {
+        auto perBatch = [](std::uint64_t count) {
+            return std::to_string(count / batches) + "." + std::to_string((count * 10 / batches) % 10);
+        };
+        err("dispatch: ", batches, " batches, ", perBatch(batchEvents), " events, ", perBatch(batchRequests),
+                " requests and ", perBatch(batchRoundTrips), " round trips per batch (at most ", worstBatchRoundTrips, ")");
+    }
+    ResizeSync::instance().report();
+    ClientTracker::instance().reportMemoryUsage();
+}
+
 int handleXError(Display *dsply, XErrorEvent *e)
 {
-    auto& clients = ClientTracker::instance();
-	auto c = clients.find(e->resourceid, WINDOW);
+    auto& tracker = ErrorTracker::instance();
 
 	if (e->error_code == BadAccess && e->resourceid == DisplayManager::instance().getRoot()) {
 		err("root window unavailable (maybe another wm is running?)");
 		exit(1);
-	} else {
-		char msg[255] = { 0 };
-		XGetErrorText(dsply, e->error_code, msg, sizeof msg);
-        err("X error (", e->resourceid, "): ", msg);
-	}
-
-	if (c) {
-        clients.withdraw(c);
 	}
+    if (tracker.expected(*e)) {
+        return 0;
+    }
+    char msg[255] = { 0 };
+    XGetErrorText(dsply, e->error_code, msg, sizeof msg);
+    auto window = tracker.blame(*e);
+    err("X error (", e->resourceid, ", request ", static_cast<int>(e->request_code), ", serial ", e->serial, ", client ", window, "): ", msg);
+    tracker.clientFailed(window);
 	return 0;
 }
 
+ErrorTracker&
+ErrorTracker::instance() noexcept {
+    static ErrorTracker tracker;
+    return tracker;
+}
+
+ErrorTracker::Scope::Scope(Window window, bool teardown) noexcept : _window(window), _teardown(teardown), _first(NextRequest(DisplayManager::instance().getDisplay())) { }
+
+ErrorTracker::Scope::~Scope() {
+    if (auto next = NextRequest(DisplayManager::instance().getDisplay()); next != _first) {
+        ErrorTracker::instance()._ranges.push_back({ _first, next - 1, _window, _teardown });
+    }
+}
+
+void
+ErrorTracker::windowGone(Window window) noexcept {
+    _gone[window] = NextRequest(DisplayManager::instance().getDisplay());
+}
+
+bool
+ErrorTracker::expected(const XErrorEvent& e) const noexcept {
+    for (const auto& range : _ranges) {
+        if (range.first <= e.serial && e.serial <= range.last) {
+            if (range.teardown) {
+                return true;
+            }
+            break;
+        }
+    }
+    auto gone = _gone.find(e.resourceid);
+    return gone != _gone.end() && e.serial < gone->second;
+}
+
+Window
+ErrorTracker::blame(const XErrorEvent& e) const noexcept {
+    for (const auto& range : _ranges) {
+        if (range.first <= e.serial && e.serial <= range.last) {
+            return range.window;
+        }
+    }
+    return e.resourceid;
+}
+
+void
+ErrorTracker::withdrawFailedClients() {
+    auto& clients = ClientTracker::instance();
+    auto failed = std::move(_failed);
+    _failed.clear();
+    for (auto window : failed) {
+        if (auto c = clients.find(window, WINDOW); c) {
+            clients.withdraw(c);
+        }
+    }
+}
+
+void
+ErrorTracker::prune() noexcept {
+    auto processed = LastKnownRequestProcessed(DisplayManager::instance().getDisplay());
+    while (!_ranges.empty() && _ranges.front().last <= processed) {
+        _ranges.pop_front();
+    }
+    for (auto it = _gone.begin(); it != _gone.end();) {
+        if (it->second <= processed) {
+            it = _gone.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
 
-/* Currently, only send_wm_delete uses this one... */
+/* Used for WM_DELETE_WINDOW and WM_TAKE_FOCUS. */
 
-int sendXMessage(Window w, Atom a, long x)
+int sendXMessage(Window w, Atom a, long x, Time time)
 {
 	XClientMessageEvent e;
 
@@ -130,12 +282,21 @@ int sendXMessage(Window w, Atom a, long x)
 	e.message_type = a;
 	e.format = 32;
 	e.data.l[0] = x;
-	e.data.l[1] = CurrentTime;
+	e.data.l[1] = time;
 
 	return XSendEvent(DisplayManager::instance().getDisplay(), w, False, NoEventMask, (XEvent *)&e);
 }
 
 
+unsigned int
+DisplayManager::queryModifierState() noexcept {
+    Window mouseRoot, mouseWin;
+    int rootX, rootY, winX, winY;
+    unsigned int mask = 0;
+    XQueryPointer(_display, _root, &mouseRoot, &mouseWin, &rootX, &rootY, &winX, &winY, &mask);
+    return mask;
+}
+
 std::tuple<int, int>
 DisplayManager::getMousePosition() noexcept {
     Window mouseRoot, mouseWin;
@@ -357,6 +518,7 @@ void quitNicely() {
         }
 	}
 	XFree(wins);
+    ct.flushRemovals();
 
     dm.free(font);
 	if (xftfont) {
@@ -375,22 +537,82 @@ void quitNicely() {
 
 void 
 drawString(XftDraw* d, XftColor* color, XftFont* font, int x, int y, const std::string& string) {
-    auto ptr = string.c_str();
-    XftDrawString8(d, color, font, x, y, (unsigned char*)ptr, string.length());
+    if (!font) {
+        // still waiting on the font during progressive startup
+        return;
+    }
+    GlyphRun::layout(font, string).draw(d, color, x, y);
+}
+
+int
+textWidth(XftFont* font, const std::string& string) {
+    return GlyphRun::layout(font, string).getWidth();
+}
+
+std::optional<std::string>
+fetchTitle(Display* disp, Window w) {
+	Atom realType;
+	int realFormat;
+	unsigned long itemsRead, itemsLeft;
+	unsigned char *data = nullptr;
+    std::optional<std::string> returned;
+    if (XGetWindowProperty(disp, w, net_wm_name, 0L, 1024L, False, utf8_string, &realType, &realFormat, &itemsRead, &itemsLeft, &data) == Success && data) {
+        if (realType == utf8_string && realFormat == 8) {
+            returned.emplace(reinterpret_cast<char*>(data), itemsRead);
+        }
+        XFree(data);
+        if (returned) {
+            return returned;
+        }
+    }
+    XTextProperty prop;
+    if (!XGetWMName(disp, w, &prop) || !prop.value) {
+        return returned;
+    }
+    returned = decodeTitle(disp, prop);
+    XFree(prop.value);
+    return returned;
 }
 
-std::tuple<Status, std::optional<std::string>> 
-fetchName(Display* disp, Window w) {
-    char* temporaryStorage = nullptr;
-    auto status = XFetchName(disp, w, &temporaryStorage);
+std::optional<std::string>
+decodeTitle(Display* disp, XTextProperty& prop) {
     std::optional<std::string> returned;
-    if (temporaryStorage) {
-        // copy and then discard the temporary
-        // learned this technique from CLIPS to prevent memory management issues
-        returned = std::make_optional(temporaryStorage);
-        XFree(temporaryStorage);
+    char** list = nullptr;
+    int count = 0;
+    if (prop.encoding == XA_STRING) {
+        // Latin-1, which is easy enough to turn into UTF-8 ourselves
+        std::string title;
+        for (unsigned long i = 0; i < prop.nitems; ++i) {
+            auto ch = prop.value[i];
+            if (ch < 0x80) {
+                title.push_back(ch);
+            } else {
+                title.push_back(0xC0 | (ch >> 6));
+                title.push_back(0x80 | (ch & 0x3F));
+            }
+        }
+        returned = title;
+    } else if (Xutf8TextPropertyToTextList(disp, &prop, &list, &count) >= Success && count > 0 && list) {
+        returned = std::make_optional(list[0]);
+    }
+    if (list) {
+        XFreeStringList(list);
     }
-    return std::make_tuple(status, returned);
+    return returned;
+}
+
+std::optional<std::string>
+fetchClass(Display* disp, Window w) {
+    XClassHint hint { nullptr, nullptr };
+    std::optional<std::string> returned;
+    if (XGetClassHint(disp, w, &hint)) {
+        if (hint.res_class) {
+            returned = std::make_optional(hint.res_class);
+        }
+        XFree(hint.res_name);
+        XFree(hint.res_class);
+    }
+    return returned;
 }
 
 void 
@@ -406,3 +628,84 @@ void
 DisplayManager::grabKeysym(unsigned int mask, KeySym keysym) noexcept {
     grabKeysym(_root, mask, keysym);
 }
+
+std::vector<Atom>
+DisplayManager::internAtoms(const std::vector<std::string>& names, Bool onlyIfExists) noexcept {
+    std::vector<char*> rawNames;
+    for (const auto& name : names) {
+        rawNames.emplace_back(const_cast<char*>(name.c_str()));
+    }
+    std::vector<Atom> atoms(names.size(), None);
+    XInternAtoms(_display, rawNames.data(), rawNames.size(), onlyIfExists, atoms.data());
+    return atoms;
+}
+
+/* Work out the pixel value for one channel of a TrueColor visual: take
+ * the top however-many bits of the 16 bit channel value and shift them
+ * into the position given by the mask. */
+static unsigned long
+scaleToMask(unsigned short value, unsigned long mask) noexcept {
+    if (!mask) {
+        return 0;
+    }
+    int shift = 0;
+    while (!((mask >> shift) & 1)) {
+        ++shift;
+    }
+    int bits = 0;
+    while ((mask >> (shift + bits)) & 1) {
+        ++bits;
+    }
+    return ((static_cast<unsigned long>(value) >> (16 - bits)) << shift) & mask;
+}
+
+bool
+DisplayManager::resolvePixel(XColor& screenInOut) noexcept {
+    if (auto visual = getDefaultVisual(); visual->c_class == TrueColor) {
+        screenInOut.pixel = scaleToMask(screenInOut.red, visual->red_mask) |
+                            scaleToMask(screenInOut.green, visual->green_mask) |
+                            scaleToMask(screenInOut.blue, visual->blue_mask);
+        screenInOut.flags = DoRed | DoGreen | DoBlue;
+        return true;
+    } else {
+        return allocColorFromDefaultColormap(screenInOut);
+    }
+}
+
+bool
+DisplayManager::resolveColor(const std::string& spec, XColor& screenDefReturn) noexcept {
+    // XParseColor handles #rgb specs without a round trip; only colour names have to go to the server
+    if (!XParseColor(_display, getDefaultColormap(), spec.c_str(), &screenDefReturn)) {
+        return false;
+    }
+    return resolvePixel(screenDefReturn);
+}
+
+const std::filesystem::path&
+getCacheDirectory() noexcept {
+    static std::filesystem::path _cache = []() {
+        if (auto xdg = getEnvironmentVariable("XDG_CACHE_HOME"); xdg && !xdg->empty()) {
+            return std::filesystem::path(*xdg) / "windowlab";
+        } else {
+            return std::filesystem::path(getEnvironmentVariable("HOME", ".")) / ".cache/windowlab";
+        }
+    }();
+    return _cache;
+}
+
+void
+writeCacheString(std::ostream& out, const std::string& str) noexcept {
+    writeCacheValue<std::uint32_t>(out, str.size());
+    out.write(str.data(), str.size());
+}
+
+bool
+readCacheString(std::istream& in, std::string& str) noexcept {
+    std::uint32_t len = 0;
+    // anything this long means the cache is garbage
+    if (!readCacheValue(in, len) || len > 65536) {
+        return false;
+    }
+    str.resize(len);
+    return static_cast<bool>(in.read(str.data(), len));
+}
@@ -49,67 +49,126 @@ Client::setDimensions(XWindowAttributes& attr) noexcept {
 
 void
 Client::makeNew(Window w) noexcept {
-	XWindowAttributes attr;
+    makeNew(std::vector<Window> { w });
+}
+
+/* Windows tend to turn up in bursts (a session being restored, a
+ * script starting a dozen terminals, or us starting up with windows
+ * already there), so they are taken on together: every window's
+ * properties are asked for before we wait for any of them, the pointer
+ * is only queried once for the lot, and they're all reparented and
+ * mapped under a single server grab with one taskbar repaint at the
+ * end. */
+void
+Client::makeNew(const std::vector<Window>& windows, bool onlyViewable) noexcept {
     auto& clients = ClientTracker::instance();
     auto& dm = DisplayManager::instance();
-    clients.add(ClientPointer(new Client(w)));
-    auto c = clients.back();
+    auto& prefetch = WindowPrefetch::instance();
+    for (auto w : windows) {
+        prefetch.request(w);
+    }
+    std::vector<std::tuple<Window, WindowDetails>> found;
+    for (auto w : windows) {
+        if (auto details = prefetch.take(w); details && !details->attributes.override_redirect) {
+            if (!onlyViewable || details->attributes.map_state == IsViewable) {
+                found.emplace_back(w, std::move(*details));
+            }
+        }
+    }
+    if (found.empty()) {
+        return;
+    }
+    // windows placed at the pointer are cascaded from it so a burst doesn't pile up in one spot
+    std::optional<std::tuple<int, int>> mouse;
+    int placed = 0;
+    std::function<std::tuple<int, int>()> mousePosition = [&mouse, &placed, &dm]() {
+        if (!mouse) {
+            mouse = dm.getMousePosition();
+        }
+        auto [x, y] = *mouse;
+        auto offset = placed++ * getBarHeight();
+        return std::make_tuple(x + offset, y + offset);
+    };
+    std::vector<ClientPointer> made;
     dm.grabServer();
-
-    dm.getTransientForHint(w, c->_trans);
-    auto [ status, opt ] = fetchName(dm.getDisplay(), w);
-    c->setName(opt);
-    dm.getWindowAttributes(w, attr);
-    c->setDimensions(attr);
-	c->_size = dm.allocSizeHints();
-    c->_selfReference = c;
-    dm.getWMNormalHints(c->_window, c->_size);
-
-	// XReparentWindow seems to try an XUnmapWindow, regardless of whether the reparented window is mapped or not
-	++c->_ignoreUnmap;
-	
-	if (attr.map_state != IsViewable) {
-        c->initPosition();
-        c->setWMState(NormalState);
-		if (auto hints = dm.getWMHints(w); hints) {
-			if (hints->flags & StateHint) {
-                c->setWMState(hints->initial_state);
-			}
-			XFree(hints);
-		}
-	}
-
-    c->fixPosition();
-    c->gravitate(APPLY_GRAVITY);
-    c->reparent();
-    c->_xftdraw = XftDrawCreate(dm.getDisplay(), (Drawable) c->_frame, dm.getDefaultVisual(), dm.getDefaultColormap());
-
-
-	if (c->getWMState() != IconicState) {
-        dm.mapWindow(c->_window);
-        dm.mapRaised(c->_frame);
-
-        clients.setTopmostClient(c);
-	} else {
-        c->setHidden(true);
-		if(attr.map_state == IsViewable) {
-			++c->_ignoreUnmap;
-            dm.unmapWindow(c->_window);
-		}
-	}
-
-	// if no client has focus give focus to the new client
-	if (!clients.hasFocusedClient()) {
-        clients.checkFocus(c);
-        clients.setFocusedClient(c);
-	}
-
-    dm.sync(False);
+    for (auto& [w, details] : found) {
+        ErrorTracker::Scope scope(w);
+        auto& attr = details.attributes;
+        clients.add(ClientPointer(new Client(w)));
+        auto c = clients.back();
+        made.emplace_back(c);
+
+        c->_trans = details.transientFor;
+        c->setName(details.title);
+        c->setClass(details.wmClass);
+        c->setDimensions(attr);
+        c->_size = ClientSizeHints(details.normalHints);
+        c->_selfReference = c;
+        c->setProtocols(details.protocols);
+        c->_wmHints = details.hints ? ClientWMHints(*details.hints) : ClientWMHints();
+        c->_wmHintsFetched = true;
+        c->_wmState = static_cast<std::int8_t>(details.wmState);
+        c->_shaped = details.shaped;
+
+        // XReparentWindow seems to try an XUnmapWindow, regardless of whether the reparented window is mapped or not
+        ++c->_ignoreUnmap;
+
+        if (auto hints = c->getWMHints(); hints) {
+            if (hints->flags & WindowGroupHint) {
+                c->setGroup(hints->window_group);
+            }
+            if (attr.map_state != IsViewable) {
+                c->initPosition(mousePosition);
+                c->setWMState((hints->flags & StateHint) ? hints->initial_state : NormalState);
+            }
+        } else if (attr.map_state != IsViewable) {
+            c->initPosition(mousePosition);
+            c->setWMState(NormalState);
+        }
+
+        c->fixPosition();
+        c->gravitate(APPLY_GRAVITY);
+        c->reparent();
+
+        if (c->getWMState() != IconicState) {
+            dm.mapWindow(c->_window);
+            dm.mapRaised(c->_frame);
+
+            clients.setTopmostClient(c);
+        } else {
+            c->setHidden(true);
+            c->_hiddenSince = std::chrono::steady_clock::now();
+            clients.scheduleReclaim();
+            if(attr.map_state == IsViewable) {
+                ++c->_ignoreUnmap;
+                dm.unmapWindow(c->_window);
+            }
+        }
+
+        // if no client has focus give focus to the new client
+        if (!clients.hasFocusedClient()) {
+            clients.checkFocus(c);
+            clients.setFocusedClient(c);
+        }
+    }
     dm.ungrabServer();
 
+    for (auto& c : made) {
+        LaunchTelemetry::instance().mapped(c);
+    }
     Taskbar::performRedraw();
 }
 
+void
+Client::updateGroup() noexcept {
+    _group = None;
+    if (auto hints = getWMHints(); hints) {
+        if (hints->flags & WindowGroupHint) {
+            _group = hints->window_group;
+        }
+    }
+}
+
 /* This one does *not* free the data coming back from Xlib; it just
  * sends back the pointer to what was allocated. */
 
@@ -130,17 +189,17 @@ Client::makeNew(Window w) noexcept {
  * your head will explode. */
 
 void
-Client::initPosition() noexcept {
+Client::initPosition(const std::function<std::tuple<int, int>()>& mousePosition) noexcept {
 	// make sure it's big enough for the 3 buttons and a bit of bar
-	if (_width < 4 * getBarHeight()) {
-		_width = 4 * getBarHeight();
+	if (_width < getMinWinWidth()) {
+		_width = getMinWinWidth();
 	}
 	if (_height < getBarHeight()) {
 		_height = getBarHeight();
 	}
 
 	if (_x == 0 && _y == 0) {
-        auto [mousex, mousey] = DisplayManager::instance().getMousePosition();
+        auto [mousex, mousey] = mousePosition();
 		_x = mousex;
 		_y = mousey + getBarHeight();
         gravitate(REMOVE_GRAVITY);
@@ -149,25 +208,26 @@ Client::initPosition() noexcept {
 
 void
 Client::reparent() noexcept {
-	XSetWindowAttributes pattr;
     auto& dm = DisplayManager::instance();
 
-	pattr.override_redirect = True;
-	pattr.background_pixel = empty_col.pixel;
-	pattr.border_pixel = border_col.pixel;
-	pattr.event_mask = ChildMask|ButtonPressMask|ExposureMask|EnterWindowMask;
-    _frame = dm.createWindow(_x, _y - getBarHeight(), _width, _height + getBarHeight(), getBorderWidth(), dm.getDefaultDepth(), CopyFromParent, dm.getDefaultVisual(), CWOverrideRedirect|CWBackPixel|CWBorderPixel|CWEventMask, pattr);
-
 	if (shape) {
 		XShapeSelectInput(dm.getDisplay(), _window, ShapeNotifyMask);
-        setShape();
 	}
 
     dm.addToSaveSet(_window);
-	dm.selectInput(_window, ColormapChangeMask|PropertyChangeMask);
+	dm.selectInput(_window, ColormapChangeMask|PropertyChangeMask|FocusChangeMask);
     dm.setWindowBorderWidth(_window, 0);
     dm.resizeWindow(_window, _width, _height);
-    dm.reparentWindow(_window, _frame, 0, getBarHeight());
+    attachFrame();
 
     sendConfig();
 }
+
+void
+Client::attachFrame() noexcept {
+    _frame = WindowPool::instance().acquire(PooledWindow::Frame, Rect { _x, _y - getBarHeight(), _width, _height + getBarHeight() });
+	if (shape) {
+        setShape();
+	}
+    DisplayManager::instance().reparentWindow(_window, _frame, 0, getBarHeight());
+}
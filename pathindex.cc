@@ -0,0 +1,277 @@
+/* WindowLab17 - An X11 window manager based off of windowlab but rewritten in C++17
+ * Based off of "WindowLab - an X11 window manager by Nick Gravgaard"
+ *
+ * WindowLab17 Copyright (c) 2020 Joshua Scoggins
+ * WindowLab Copyright (c) 2001-2010 Nick Gravgaard
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include <sys/inotify.h>
+#include <fcntl.h>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include "windowlab.h"
+
+PathIndex&
+PathIndex::instance() noexcept {
+    static PathIndex _index;
+    return _index;
+}
+
+static std::int64_t
+modificationTime(const std::filesystem::path& path) noexcept {
+    std::error_code ec;
+    auto modified = std::filesystem::last_write_time(path, ec);
+    return ec ? 0 : modified.time_since_epoch().count();
+}
+
+static std::vector<std::string>
+scanDirectory(const std::filesystem::path& dir) noexcept {
+    std::vector<std::string> names;
+    std::error_code ec;
+    constexpr auto anyExec = std::filesystem::perms::owner_exec | std::filesystem::perms::group_exec | std::filesystem::perms::others_exec;
+    for (auto it = std::filesystem::directory_iterator(dir, ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+        std::error_code statEc;
+        // follows symlinks, which is what we want since most of /usr/bin seems to be them these days
+        auto status = it->status(statEc);
+        if (!statEc && std::filesystem::is_regular_file(status) && (status.permissions() & anyExec) != std::filesystem::perms::none) {
+            names.emplace_back(it->path().filename().string());
+        }
+    }
+    return names;
+}
+
+static std::filesystem::path
+getPathIndexCachePath() noexcept {
+    return getCacheDirectory() / "path.index";
+}
+
+/* Work out which directories we are indexing and fill in whatever we
+ * can from the cache. */
+void
+PathIndex::load() {
+    _searchPath = getEnvironmentVariable("PATH", "/usr/local/bin:/usr/bin:/bin");
+    std::istringstream paths(_searchPath);
+    std::string entry;
+    while (std::getline(paths, entry, ':')) {
+        // an empty entry means the current directory, which doesn't mean anything useful for us
+        if (entry.empty() || std::any_of(_directories.begin(), _directories.end(), [&entry](const Directory& d) { return d.path == entry; })) {
+            continue;
+        }
+        Directory dir;
+        dir.path = entry;
+        _directories.emplace_back(std::move(dir));
+    }
+    loadCache();
+    for (std::size_t i = 0; i < _directories.size(); ++i) {
+        _directories[i].watch = FileWatcher::instance().watchDirectory(_directories[i].path, IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM | IN_ATTRIB | IN_CLOSE_WRITE,
+                [i](const std::string&) { PathIndex::instance()._directories[i].stale = true; });
+    }
+}
+
+namespace {
+    struct Scan {
+        std::size_t directory;
+        std::filesystem::path path;
+        std::int64_t modified = 0;
+        std::vector<std::string> names;
+    };
+}
+
+/* Scan each of the given directories, spreading them out over a few
+ * threads since most of the time goes on stat()ing each entry. */
+static void
+scanDirectories(std::vector<Scan>& scans) noexcept {
+    std::atomic<std::size_t> next { 0 };
+    auto worker = [&scans, &next]() {
+        for (auto i = next++; i < scans.size(); i = next++) {
+            // take the time first so that a change during the scan leaves us looking out of date rather than current
+            scans[i].modified = modificationTime(scans[i].path);
+            scans[i].names = scanDirectory(scans[i].path);
+        }
+    };
+    std::size_t threadCount = std::min<std::size_t>(scans.size(), std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < threadCount; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+/* Rescan every stale directory on a thread of its own, so that a cold
+ * $PATH doesn't hold up the event loop. The thread only touches its own
+ * copy of what it is scanning, and hands the results back through a
+ * pipe as a pointer for scanFinished() to pick up. It is detached, so
+ * that quitting doesn't have to wait for it. A directory which changes
+ * while it is being scanned is marked stale again by its watch. */
+void
+PathIndex::scanStale() {
+    if (_scanning) {
+        return;
+    }
+    if (_scanDone[0] == -1) {
+        if (pipe(_scanDone) != 0) {
+            err("can't create pipe for scanning $PATH: ", strerror(errno));
+            return;
+        }
+        fcntl(_scanDone[0], F_SETFD, FD_CLOEXEC);
+        fcntl(_scanDone[1], F_SETFD, FD_CLOEXEC);
+        addEventSource(_scanDone[0], []() { PathIndex::instance().scanFinished(); });
+    }
+    auto scans = std::make_unique<std::vector<Scan>>();
+    for (std::size_t i = 0; i < _directories.size(); ++i) {
+        if (_directories[i].stale) {
+            _directories[i].stale = false;
+            auto& scan = scans->emplace_back();
+            scan.directory = i;
+            scan.path = _directories[i].path;
+        }
+    }
+    if (scans->empty()) {
+        return;
+    }
+    _scanning = true;
+    std::thread([scans = scans.release(), fd = _scanDone[1]]() {
+                scanDirectories(*scans);
+                (void)write(fd, &scans, sizeof scans);
+            }).detach();
+}
+
+void
+PathIndex::scanFinished() {
+    std::vector<Scan>* done = nullptr;
+    if (read(_scanDone[0], &done, sizeof done) != sizeof done) {
+        return;
+    }
+    std::unique_ptr<std::vector<Scan>> scans(done);
+    _scanning = false;
+    for (auto& scan : *scans) {
+        auto& dir = _directories[scan.directory];
+        dir.modified = scan.modified;
+        dir.names = std::move(scan.names);
+    }
+    rebuild();
+    saveCache();
+    if (auto updated = std::exchange(_updated, nullptr); updated) {
+        updated();
+    }
+}
+
+void
+PathIndex::rebuild() {
+    _names.clear();
+    for (const auto& dir : _directories) {
+        _names.insert(_names.end(), dir.names.begin(), dir.names.end());
+    }
+    // the same name in two directories only runs the first one anyway
+    std::sort(_names.begin(), _names.end());
+    _names.erase(std::unique(_names.begin(), _names.end()), _names.end());
+    std::size_t bytes = 0;
+    for (const auto& name : _names) {
+        bytes += name.size();
+    }
+    _index.clear();
+    _index.reserve(_names.size(), bytes);
+    for (const auto& name : _names) {
+        _index.add(name);
+    }
+}
+
+std::vector<FuzzyIndex::Match>
+PathIndex::search(std::string_view query, std::size_t limit, std::function<void()> updated) {
+    if (_directories.empty()) {
+        load();
+        // whatever the cache had will do until the scan catches up
+        rebuild();
+    }
+    _updated = std::move(updated);
+    scanStale();
+    return _index.search(query, limit);
+}
+
+/* The cache is a list of directories, each with the modification time
+ * it had when it was scanned and the executables found in it. A
+ * directory is only believed if its modification time still matches:
+ *
+ * magic, version, directory count, then (path, mtime, name count, names) for each. */
+constexpr std::uint32_t PATH_INDEX_MAGIC = 0x49504c57; // "WLPI"
+constexpr std::uint32_t PATH_INDEX_VERSION = 1;
+
+bool
+PathIndex::loadCache() {
+    std::ifstream cache(getPathIndexCachePath(), std::ios::binary);
+    std::uint32_t magic = 0, version = 0, count = 0;
+    if (!readCacheValue(cache, magic) || magic != PATH_INDEX_MAGIC ||
+        !readCacheValue(cache, version) || version != PATH_INDEX_VERSION ||
+        !readCacheValue(cache, count)) {
+        return false;
+    }
+    for (std::uint32_t i = 0; i < count; ++i) {
+        std::string path;
+        std::int64_t modified = 0;
+        std::uint32_t nameCount = 0;
+        if (!readCacheString(cache, path) || !readCacheValue(cache, modified) || !readCacheValue(cache, nameCount)) {
+            return false;
+        }
+        std::vector<std::string> names(nameCount);
+        for (auto& name : names) {
+            if (!readCacheString(cache, name)) {
+                return false;
+            }
+        }
+        for (auto& dir : _directories) {
+            if (dir.path == path && modified != 0 && modificationTime(dir.path) == modified) {
+                dir.modified = modified;
+                dir.names = std::move(names);
+                dir.stale = false;
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+void
+PathIndex::saveCache() const {
+    std::error_code ec;
+    std::filesystem::create_directories(getCacheDirectory(), ec);
+    auto tmpPath = getPathIndexCachePath();
+    tmpPath += ".tmp";
+    std::ofstream cache(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!cache.is_open()) {
+        return;
+    }
+    writeCacheValue(cache, PATH_INDEX_MAGIC);
+    writeCacheValue(cache, PATH_INDEX_VERSION);
+    writeCacheValue<std::uint32_t>(cache, _directories.size());
+    for (const auto& dir : _directories) {
+        writeCacheString(cache, dir.path.string());
+        writeCacheValue(cache, dir.modified);
+        writeCacheValue<std::uint32_t>(cache, dir.names.size());
+        for (const auto& name : dir.names) {
+            writeCacheString(cache, name);
+        }
+    }
+    cache.close();
+    if (cache) {
+        std::filesystem::rename(tmpPath, getPathIndexCachePath(), ec);
+    }
+}
@@ -0,0 +1,155 @@
+/* WindowLab17 - An X11 window manager based off of windowlab but rewritten in C++17
+ * Based off of "WindowLab - an X11 window manager by Nick Gravgaard"
+ *
+ * WindowLab17 Copyright (c) 2020 Joshua Scoggins
+ * WindowLab Copyright (c) 2001-2010 Nick Gravgaard
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include "windowlab.h"
+
+namespace {
+
+// how many of each kind are made at startup and kept however long they sit idle
+constexpr std::size_t primed[] = { 2, 1, 1 };
+
+constexpr std::size_t
+index(PooledWindow kind) noexcept {
+    return static_cast<std::size_t>(kind);
+}
+
+} // end namespace
+
+WindowPool&
+WindowPool::instance() noexcept {
+    static WindowPool pool;
+    return pool;
+}
+
+Window
+WindowPool::create(PooledWindow kind, const Rect& dims) {
+    auto& dm = DisplayManager::instance();
+	XSetWindowAttributes pattr;
+    pattr.override_redirect = True;
+    switch (kind) {
+        case PooledWindow::Frame:
+            pattr.background_pixel = empty_col.pixel;
+            pattr.border_pixel = border_col.pixel;
+            pattr.event_mask = ChildMask|ButtonPressMask|ExposureMask|EnterWindowMask;
+            return dm.createWindow(dims, getBorderWidth(), dm.getDefaultDepth(), CopyFromParent, dm.getDefaultVisual(), CWOverrideRedirect|CWBackPixel|CWBorderPixel|CWEventMask, pattr);
+        case PooledWindow::Constraint:
+            // override_redirect so that we don't mistake it for a client on its way
+            return dm.createWindow(dims, 0, CopyFromParent, InputOnly, CopyFromParent, CWOverrideRedirect, pattr);
+        case PooledWindow::ResizeOutline: {
+            pattr.background_pixel = menu_col.pixel;
+            pattr.border_pixel = border_col.pixel;
+            pattr.event_mask = ChildMask|ButtonPressMask|ExposureMask|EnterWindowMask;
+            auto outline = dm.createWindow(dims, DEF_BORDERWIDTH, dm.getDefaultDepth(), CopyFromParent, dm.getDefaultVisual(), CWOverrideRedirect|CWBackPixel|CWBorderPixel|CWEventMask, pattr);
+            pattr.background_pixel = active_col.pixel;
+            auto bar = dm.createWindow(outline, -DEF_BORDERWIDTH, -DEF_BORDERWIDTH, dims.getWidth(), getBarHeight() - DEF_BORDERWIDTH, DEF_BORDERWIDTH, dm.getDefaultDepth(), CopyFromParent, dm.getDefaultVisual(), CWOverrideRedirect|CWBackPixel|CWBorderPixel|CWEventMask, pattr);
+            // it only shows when the outline does
+            dm.mapWindow(bar);
+            _resizeBars[outline] = bar;
+            return outline;
+        }
+        default:
+            return None;
+    }
+}
+
+void
+WindowPool::destroy(PooledWindow kind, Window w) {
+    if (kind == PooledWindow::ResizeOutline) {
+        _resizeBars.erase(w);
+    }
+    DisplayManager::instance().destroyWindow(w);
+}
+
+Window
+WindowPool::acquire(PooledWindow kind, const Rect& dims) {
+    auto& idle = _idle[index(kind)];
+    if (idle.empty()) {
+        return create(kind, dims);
+    }
+    // the most recently used, so the ones that have been sitting longest age out
+    auto w = idle.back().window;
+    idle.pop_back();
+	XWindowChanges wc;
+    wc.x = dims.getX();
+    wc.y = dims.getY();
+    wc.width = dims.getWidth();
+    wc.height = dims.getHeight();
+    wc.border_width = kind == PooledWindow::Frame ? getBorderWidth() : kind == PooledWindow::ResizeOutline ? DEF_BORDERWIDTH : 0;
+    DisplayManager::instance().configureWindow(w, CWX|CWY|CWWidth|CWHeight|CWBorderWidth, wc);
+    return w;
+}
+
+void
+WindowPool::release(PooledWindow kind, Window w) {
+    auto& dm = DisplayManager::instance();
+    auto& idle = _idle[index(kind)];
+    if (idle.size() >= MAX_POOLED_WINDOWS) {
+        destroy(kind, w);
+        return;
+    }
+    dm.unmapWindow(w);
+    idle.push_back({ w, std::chrono::steady_clock::now() });
+    if (!_reclaimScheduled && idle.size() > primed[index(kind)]) {
+        _reclaimScheduled = true;
+        addTimer(std::chrono::duration_cast<std::chrono::milliseconds>(POOLED_WINDOW_IDLE_TIME), []() { WindowPool::instance().reclaim(); });
+    }
+}
+
+Window
+WindowPool::getResizeBar(Window outline) const {
+    if (auto found = _resizeBars.find(outline); found != _resizeBars.end()) {
+        return found->second;
+    }
+    return None;
+}
+
+void
+WindowPool::prime() {
+    Rect dims { 0, 0, 1, 1 };
+    for (auto kind : { PooledWindow::Frame, PooledWindow::Constraint, PooledWindow::ResizeOutline }) {
+        auto& idle = _idle[index(kind)];
+        while (idle.size() < primed[index(kind)]) {
+            idle.push_back({ create(kind, dims), std::chrono::steady_clock::now() });
+        }
+    }
+}
+
+void
+WindowPool::reclaim() {
+    _reclaimScheduled = false;
+    auto now = std::chrono::steady_clock::now();
+    bool surplus = false;
+    for (auto kind : { PooledWindow::Frame, PooledWindow::Constraint, PooledWindow::ResizeOutline }) {
+        auto& idle = _idle[index(kind)];
+        // oldest first, and never below what we primed
+        auto keep = primed[index(kind)];
+        while (idle.size() > keep && now - idle.front().since >= POOLED_WINDOW_IDLE_TIME) {
+            destroy(kind, idle.front().window);
+            idle.erase(idle.begin());
+        }
+        surplus = surplus || idle.size() > keep;
+    }
+    if (surplus) {
+        _reclaimScheduled = true;
+        addTimer(std::chrono::duration_cast<std::chrono::milliseconds>(POOLED_WINDOW_IDLE_TIME), []() { WindowPool::instance().reclaim(); });
+    }
+}
@@ -0,0 +1,436 @@
+/* WindowLab17 - An X11 window manager based off of windowlab but rewritten in C++17
+ * Based off of "WindowLab - an X11 window manager by Nick Gravgaard"
+ *
+ * WindowLab17 Copyright (c) 2020 Joshua Scoggins
+ * WindowLab Copyright (c) 2001-2010 Nick Gravgaard
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include <sys/uio.h>
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
+#include <X11/Xatom.h>
+#include "windowlab.h"
+
+namespace {
+
+// what we ask about each window
+enum Item {
+    Attributes,
+    Geometry,
+    NetWMName,
+    WMName,
+    WMClass,
+    WMHints,
+    WMNormalHints,
+    WMTransientFor,
+    WMProtocols,
+    WMState,
+    Shape,
+    ItemCount,
+};
+
+// xcb only comes with the core protocol here, so ShapeQueryExtents is sent by hand
+xcb_extension_t shapeExtension = { "SHAPE", 0 };
+constexpr std::uint8_t ShapeQueryExtentsOpcode = 5;
+
+unsigned int
+queryShapeExtents(xcb_connection_t* connection, Window w) {
+    struct {
+        std::uint8_t majorOpcode;
+        std::uint8_t minorOpcode;
+        std::uint16_t length;
+        std::uint32_t window;
+    } request { 0, 0, 0, static_cast<std::uint32_t>(w) };
+    static const xcb_protocol_request_t protocolRequest = { 2, &shapeExtension, ShapeQueryExtentsOpcode, 0 };
+    iovec parts[4];
+    parts[2].iov_base = &request;
+    parts[2].iov_len = sizeof request;
+    parts[3].iov_base = nullptr;
+    parts[3].iov_len = -parts[2].iov_len & 3;
+    return xcb_send_request(connection, XCB_REQUEST_CHECKED, parts + 2, &protocolRequest);
+}
+
+// xcb replies are malloc'd
+template<typename T>
+using Reply = std::unique_ptr<T, decltype(&std::free)>;
+
+Reply<void>
+waitFor(xcb_connection_t* connection, std::optional<unsigned int> sequence) {
+    if (!sequence) {
+        return { nullptr, &std::free };
+    }
+    xcb_generic_error_t* error = nullptr;
+    auto reply = xcb_wait_for_reply(connection, *sequence, &error);
+    std::free(error);
+    return { reply, &std::free };
+}
+
+// the 32 bit values of a format 32 property
+std::vector<std::uint32_t>
+values32(const xcb_get_property_reply_t* reply, xcb_atom_t type) {
+    if (!reply || reply->format != 32 || (type != XCB_ATOM_ANY && reply->type != type)) {
+        return {};
+    }
+    auto data = static_cast<const std::uint32_t*>(xcb_get_property_value(reply));
+    return { data, data + xcb_get_property_value_length(reply) / 4 };
+}
+
+std::string
+text(const xcb_get_property_reply_t* reply) {
+    return { static_cast<const char*>(xcb_get_property_value(reply)), static_cast<std::size_t>(xcb_get_property_value_length(reply)) };
+}
+
+} // end namespace
+
+struct WindowPrefetch::Pending {
+    // nothing for what hasn't been asked for yet (or has to be asked again)
+    std::array<std::optional<unsigned int>, ItemCount> sequences;
+};
+
+WindowPrefetch&
+WindowPrefetch::instance() noexcept {
+    static WindowPrefetch prefetch;
+    return prefetch;
+}
+
+WindowPrefetch::~WindowPrefetch() {
+    if (_connection) {
+        xcb_disconnect(_connection);
+    }
+}
+
+bool
+WindowPrefetch::connect() noexcept {
+    if (!_tried) {
+        _tried = true;
+        _connection = xcb_connect(DisplayString(DisplayManager::instance().getDisplay()), nullptr);
+        if (xcb_connection_has_error(_connection)) {
+            err("can't open a second connection for reading window properties, so they'll be read one window at a time");
+            xcb_disconnect(_connection);
+            _connection = nullptr;
+        }
+    }
+    return _connection;
+}
+
+void
+WindowPrefetch::request(Window w) {
+    if (!connect()) {
+        return;
+    }
+    auto& pending = _pending[w];
+    if (!pending) {
+        pending = std::make_unique<Pending>();
+    }
+    auto property = [this, w](Atom name, Atom type) {
+        return xcb_get_property(_connection, 0, w, name, type, 0, 1024).sequence;
+    };
+    for (int item = 0; item < ItemCount; ++item) {
+        auto& sequence = pending->sequences[item];
+        if (sequence) {
+            continue;
+        }
+        switch (item) {
+            case Attributes: sequence = xcb_get_window_attributes(_connection, w).sequence; break;
+            case Geometry: sequence = xcb_get_geometry(_connection, w).sequence; break;
+            case NetWMName: sequence = property(net_wm_name, utf8_string); break;
+            case WMName: sequence = property(XA_WM_NAME, XCB_ATOM_ANY); break;
+            case WMClass: sequence = property(XA_WM_CLASS, XA_STRING); break;
+            case WMHints: sequence = property(XA_WM_HINTS, XA_WM_HINTS); break;
+            case WMNormalHints: sequence = property(XA_WM_NORMAL_HINTS, XA_WM_SIZE_HINTS); break;
+            case WMTransientFor: sequence = property(XA_WM_TRANSIENT_FOR, XA_WINDOW); break;
+            case WMProtocols: sequence = property(wm_protos, XA_ATOM); break;
+            case WMState: sequence = property(wm_state, wm_state); break;
+            case Shape:
+                if (shape) {
+                    sequence = queryShapeExtents(_connection, w);
+                }
+                break;
+        }
+    }
+    xcb_flush(_connection);
+}
+
+/* Creating a window and mapping it are usually a few milliseconds
+ * apart while the client sets its properties, which is plenty of time
+ * to have its details on the way before the MapRequest turns up.
+ * Anything the client changes in the meantime we hear about (we select
+ * for PropertyNotify and ShapeNotify on it here) and ask for again in
+ * take(). So that a change can't slip in before the server has seen
+ * our selection, the requests only go out once it has (speculate()). */
+void
+WindowPrefetch::created(Window w) {
+    if (!connect()) {
+        return;
+    }
+    auto& dm = DisplayManager::instance();
+    // plenty of windows are created and never mapped, so only so many are kept on spec
+    while (_speculative.size() >= MAX_SPECULATIVE_PREFETCHES) {
+        auto oldest = _speculative.front();
+        {
+            ErrorTracker::Scope scope(std::get<0>(oldest), true);
+            dm.selectInput(std::get<0>(oldest), NoEventMask);
+        }
+        forget(std::get<0>(oldest));
+    }
+    // it may be gone again already, and that's fine
+    ErrorTracker::Scope scope(w, true);
+    dm.selectInput(w, PropertyChangeMask);
+    if (shape) {
+        XShapeSelectInput(dm.getDisplay(), w, ShapeNotifyMask);
+    }
+    _speculative.emplace_back(w, NextRequest(dm.getDisplay()) - 1, false);
+}
+
+void
+WindowPrefetch::speculate() {
+    auto processed = LastKnownRequestProcessed(DisplayManager::instance().getDisplay());
+    for (auto& [w, serial, requested] : _speculative) {
+        if (!requested && serial <= processed) {
+            request(w);
+            requested = true;
+        }
+    }
+}
+
+void
+WindowPrefetch::invalidate(Window w, int item) {
+    if (auto found = _pending.find(w); found != _pending.end()) {
+        if (auto& sequence = found->second->sequences[item]; sequence) {
+            xcb_discard_reply(_connection, *sequence);
+            sequence.reset();
+        }
+    }
+}
+
+void
+WindowPrefetch::propertyChanged(Window w, Atom property) {
+    constexpr std::pair<Atom, Item> items[] = {
+        { XA_WM_NAME, WMName },
+        { XA_WM_CLASS, WMClass },
+        { XA_WM_HINTS, WMHints },
+        { XA_WM_NORMAL_HINTS, WMNormalHints },
+        { XA_WM_TRANSIENT_FOR, WMTransientFor },
+    };
+    for (auto [atom, item] : items) {
+        if (atom == property) {
+            invalidate(w, item);
+        }
+    }
+    if (property == net_wm_name) {
+        invalidate(w, NetWMName);
+    } else if (property == wm_protos) {
+        invalidate(w, WMProtocols);
+    } else if (property == wm_state) {
+        invalidate(w, WMState);
+    }
+}
+
+void
+WindowPrefetch::shapeChanged(Window w) {
+    invalidate(w, Shape);
+}
+
+/* We can't rely on a geometry request over our own connection seeing
+ * a configure we've only just sent over Xlib's, so we remember what we
+ * set and lay it over whatever comes back. */
+void
+WindowPrefetch::configured(Window w, unsigned int mask, const XWindowChanges& changes) {
+    if (_configured.size() >= MAX_SPECULATIVE_PREFETCHES && !_configured.count(w)) {
+        // something is configuring a lot of windows it never maps; forget about them
+        _configured.clear();
+    }
+    auto& [configuredMask, configuredChanges] = _configured[w];
+    configuredMask |= mask;
+    if (mask & CWX) { configuredChanges.x = changes.x; }
+    if (mask & CWY) { configuredChanges.y = changes.y; }
+    if (mask & CWWidth) { configuredChanges.width = changes.width; }
+    if (mask & CWHeight) { configuredChanges.height = changes.height; }
+    if (mask & CWBorderWidth) { configuredChanges.border_width = changes.border_width; }
+}
+
+void
+WindowPrefetch::forget(Window w) {
+    if (auto found = _pending.find(w); found != _pending.end()) {
+        for (auto& sequence : found->second->sequences) {
+            if (sequence) {
+                xcb_discard_reply(_connection, *sequence);
+            }
+        }
+        _pending.erase(found);
+    }
+    _speculative.erase(std::remove_if(_speculative.begin(), _speculative.end(), [w](const auto& entry) { return std::get<0>(entry) == w; }), _speculative.end());
+    _configured.erase(w);
+}
+
+std::optional<WindowDetails>
+WindowPrefetch::take(Window w) {
+    if (!connect()) {
+        return readWithXlib(w);
+    }
+    // fills in anything that was never asked for or has changed since
+    request(w);
+    auto pending = std::move(_pending[w]);
+    _pending.erase(w);
+    std::vector<Reply<void>> replies;
+    for (auto sequence : pending->sequences) {
+        replies.emplace_back(waitFor(_connection, sequence));
+    }
+    auto configured = _configured.find(w);
+    std::optional<std::tuple<unsigned int, XWindowChanges>> overlay;
+    if (configured != _configured.end()) {
+        overlay = configured->second;
+    }
+    forget(w);
+    auto attributes = static_cast<xcb_get_window_attributes_reply_t*>(replies[Attributes].get());
+    auto geometry = static_cast<xcb_get_geometry_reply_t*>(replies[Geometry].get());
+    auto property = [&replies](Item item) { return static_cast<xcb_get_property_reply_t*>(replies[item].get()); };
+    if (!attributes || !geometry) {
+        // gone already
+        return std::nullopt;
+    }
+
+    WindowDetails details;
+    details.attributes.x = geometry->x;
+    details.attributes.y = geometry->y;
+    details.attributes.width = geometry->width;
+    details.attributes.height = geometry->height;
+    details.attributes.border_width = geometry->border_width;
+    details.attributes.map_state = attributes->map_state;
+    details.attributes.colormap = attributes->colormap;
+    details.attributes.override_redirect = attributes->override_redirect;
+    if (overlay) {
+        auto& [mask, changes] = *overlay;
+        if (mask & CWX) { details.attributes.x = changes.x; }
+        if (mask & CWY) { details.attributes.y = changes.y; }
+        if (mask & CWWidth) { details.attributes.width = changes.width; }
+        if (mask & CWHeight) { details.attributes.height = changes.height; }
+        if (mask & CWBorderWidth) { details.attributes.border_width = changes.border_width; }
+    }
+
+    if (auto name = property(NetWMName); name && name->format == 8 && name->type == utf8_string && xcb_get_property_value_length(name)) {
+        details.title = text(name);
+    } else if (auto name = property(WMName); name && name->format == 8 && name->type != XCB_ATOM_NONE) {
+        auto value = text(name);
+        XTextProperty prop { reinterpret_cast<unsigned char*>(value.data()), name->type, name->format, value.size() };
+        details.title = decodeTitle(DisplayManager::instance().getDisplay(), prop);
+    }
+    if (auto wmClass = property(WMClass); wmClass && wmClass->format == 8) {
+        // res_name, then res_class, each NUL terminated
+        auto value = text(wmClass);
+        if (auto split = value.find('\0'); split != std::string::npos && split + 1 < value.size()) {
+            details.wmClass = std::string(value.c_str() + split + 1);
+        }
+    }
+    // these follow what XGetWMHints and XGetWMNormalHints do with the raw property
+    if (auto hints = values32(property(WMHints), XA_WM_HINTS); hints.size() >= 8) {
+        XWMHints& h = details.hints.emplace();
+        h.flags = hints[0];
+        h.input = hints[1] ? True : False;
+        h.initial_state = static_cast<std::int32_t>(hints[2]);
+        h.icon_pixmap = hints[3];
+        h.icon_window = hints[4];
+        h.icon_x = static_cast<std::int32_t>(hints[5]);
+        h.icon_y = static_cast<std::int32_t>(hints[6]);
+        h.icon_mask = hints[7];
+        if (hints.size() >= 9) {
+            h.window_group = hints[8];
+        } else {
+            h.flags &= ~WindowGroupHint;
+        }
+    }
+    if (auto size = values32(property(WMNormalHints), XA_WM_SIZE_HINTS); size.size() >= 15) {
+        auto value = [&size](std::size_t i) { return static_cast<int>(static_cast<std::int32_t>(size[i])); };
+        XSizeHints& s = details.normalHints;
+        s.flags = size[0] & (USPosition|USSize|PAllHints|PBaseSize|PWinGravity);
+        s.x = value(1);
+        s.y = value(2);
+        s.width = value(3);
+        s.height = value(4);
+        s.min_width = value(5);
+        s.min_height = value(6);
+        s.max_width = value(7);
+        s.max_height = value(8);
+        s.width_inc = value(9);
+        s.height_inc = value(10);
+        s.min_aspect.x = value(11);
+        s.min_aspect.y = value(12);
+        s.max_aspect.x = value(13);
+        s.max_aspect.y = value(14);
+        if (size.size() >= 18) {
+            s.base_width = value(15);
+            s.base_height = value(16);
+            s.win_gravity = value(17);
+        } else {
+            s.flags &= ~(PBaseSize|PWinGravity);
+        }
+    }
+    if (auto transient = values32(property(WMTransientFor), XA_WINDOW); !transient.empty()) {
+        details.transientFor = transient[0];
+    }
+    auto protocols = values32(property(WMProtocols), XA_ATOM);
+    details.protocols.assign(protocols.begin(), protocols.end());
+    if (auto state = values32(property(WMState), wm_state); !state.empty()) {
+        details.wmState = state[0];
+    }
+    if (auto shapeReply = replies[Shape].get(); shapeReply) {
+        // see xShapeQueryExtentsReply in X11/extensions/shapeproto.h
+        details.shaped = static_cast<const std::uint8_t*>(shapeReply)[8];
+    }
+    return details;
+}
+
+std::optional<WindowDetails>
+WindowPrefetch::readWithXlib(Window w) {
+    auto& dm = DisplayManager::instance();
+    WindowDetails details;
+    if (!dm.getWindowAttributes(w, details.attributes)) {
+        return std::nullopt;
+    }
+    details.title = fetchTitle(dm.getDisplay(), w);
+    details.wmClass = fetchClass(dm.getDisplay(), w);
+    if (auto hints = dm.getWMHints(w); hints) {
+        details.hints = *hints;
+        XFree(hints);
+    }
+    dm.getWMNormalHints(w, &details.normalHints);
+    dm.getTransientForHint(w, details.transientFor);
+    int n = 0;
+    if (Atom* protocols = nullptr; XGetWMProtocols(dm.getDisplay(), w, &protocols, &n)) {
+        details.protocols.assign(protocols, protocols + n);
+        XFree(protocols);
+    }
+    Atom realType;
+    int realFormat;
+    unsigned long itemsRead, itemsLeft;
+    unsigned char* data = nullptr;
+    if (dm.getWindowProperty(w, wm_state, 0L, 2L, False, wm_state, &realType, &realFormat, &itemsRead, &itemsLeft, &data) == Success && data) {
+        if (itemsRead) {
+            details.wmState = *reinterpret_cast<long*>(data);
+        }
+        XFree(data);
+    }
+    if (shape) {
+        Bool boundingShaped = False, clipShaped = False;
+        int xb = 0, yb = 0, xc = 0, yc = 0;
+        unsigned int wb = 0, hb = 0, wc = 0, hc = 0;
+        XShapeQueryExtents(dm.getDisplay(), w, &boundingShaped, &xb, &yb, &wb, &hb, &clipShaped, &xc, &yc, &wc, &hc);
+        details.shaped = boundingShaped;
+    }
+    return details;
+}
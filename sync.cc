@@ -0,0 +1,236 @@
+/* WindowLab17 - An X11 window manager based off of windowlab but rewritten in C++17
+ * Based off of "WindowLab - an X11 window manager by Nick Gravgaard"
+ *
+ * WindowLab17 Copyright (c) 2020 Joshua Scoggins
+ * WindowLab Copyright (c) 2001-2010 Nick Gravgaard
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <X11/extensions/sync.h>
+#include "windowlab.h"
+
+/* _NET_WM_SYNC_REQUEST, from the EWMH. A client that lists it in
+ * WM_PROTOCOLS puts an XSync counter in _NET_WM_SYNC_REQUEST_COUNTER.
+ * Before we configure the client we send it a new value for the
+ * counter, and when it has redrawn at its new size it sets the counter
+ * to that value. One alarm per client (changed to wait for each new
+ * value) tells us when that happens. Until it does, whatever else we
+ * would have done to the client is held back, and only the latest of
+ * those is applied, so a client that can't keep up doesn't fall
+ * further and further behind. */
+
+namespace {
+    XSyncValue
+    toSyncValue(std::uint64_t value) noexcept {
+        XSyncValue result;
+        XSyncIntsToValue(&result, static_cast<unsigned int>(value & 0xffffffff), static_cast<int>(value >> 32));
+        return result;
+    }
+    std::uint64_t
+    fromSyncValue(const XSyncValue& value) noexcept {
+        return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(XSyncValueHigh32(value))) << 32) | XSyncValueLow32(value);
+    }
+}
+
+ResizeSync&
+ResizeSync::instance() noexcept {
+    static ResizeSync sync;
+    return sync;
+}
+
+void
+ResizeSync::init() {
+    auto display = DisplayManager::instance().getDisplay();
+    int errorBase = 0;
+    int major = 0;
+    int minor = 0;
+    _available = XSyncQueryExtension(display, &_eventBase, &errorBase) && XSyncInitialize(display, &major, &minor);
+}
+
+void
+ResizeSync::configure(ClientPointer c, bool resizing, std::function<void()> apply) {
+    auto state = _available ? stateFor(c) : nullptr;
+    if (!state) {
+        apply();
+        return;
+    }
+    if (state->waiting) {
+        // the client is still drawing the last one
+        state->deferred = std::move(apply);
+        state->deferredResizing = state->deferredResizing || resizing;
+        ++_deferred;
+        return;
+    }
+    if (resizing) {
+        request(c->getWindow(), *state);
+    }
+    apply();
+}
+
+ResizeSync::State*
+ResizeSync::stateFor(const ClientPointer& c) {
+    auto w = c->getWindow();
+    if (auto found = _states.find(w); found != _states.end()) {
+        return found->second.counter ? &found->second : nullptr;
+    }
+    auto& state = _states[w];
+    state.client = c;
+    if (!c->supportsProtocol(net_wm_sync_request)) {
+        return nullptr;
+    }
+    auto& dm = DisplayManager::instance();
+    ErrorTracker::Scope scope(w);
+	Atom realType;
+	int realFormat;
+	unsigned long itemsRead, itemsLeft;
+	unsigned char *data = nullptr;
+    if (dm.getWindowProperty(w, net_wm_sync_request_counter, 0L, 1L, False, XA_CARDINAL, &realType, &realFormat, &itemsRead, &itemsLeft, &data) == Success && data) {
+        if (realFormat == 32 && itemsRead == 1) {
+            state.counter = *reinterpret_cast<long*>(data);
+        }
+        XFree(data);
+    }
+    XSyncValue current;
+    if (!state.counter || !XSyncQueryCounter(dm.getDisplay(), state.counter, &current)) {
+        state.counter = None;
+        return nullptr;
+    }
+    state.value = fromSyncValue(current);
+    XSyncAlarmAttributes attr;
+    attr.trigger.counter = state.counter;
+    attr.trigger.value_type = XSyncAbsolute;
+    attr.trigger.wait_value = toSyncValue(state.value + 1);
+    attr.trigger.test_type = XSyncPositiveComparison;
+    XSyncIntToValue(&attr.delta, 1);
+    attr.events = True;
+    state.alarm = XSyncCreateAlarm(dm.getDisplay(), XSyncCACounter|XSyncCAValueType|XSyncCAValue|XSyncCATestType|XSyncCADelta|XSyncCAEvents, &attr);
+    if constexpr (debugActive()) {
+        err("window ", w, " syncs resizes with counter ", state.counter, " from ", state.value);
+    }
+    return &state;
+}
+
+void
+ResizeSync::request(Window w, State& state) {
+    auto& dm = DisplayManager::instance();
+    ++state.value;
+    XSyncAlarmAttributes attr;
+    attr.trigger.wait_value = toSyncValue(state.value);
+    XSyncChangeAlarm(dm.getDisplay(), state.alarm, XSyncCAValue, &attr);
+
+	XClientMessageEvent e {};
+	e.type = ClientMessage;
+	e.window = w;
+	e.message_type = wm_protos;
+	e.format = 32;
+	e.data.l[0] = net_wm_sync_request;
+	e.data.l[1] = CurrentTime;
+	e.data.l[2] = static_cast<long>(state.value & 0xffffffff);
+	e.data.l[3] = static_cast<long>(state.value >> 32);
+    dm.sendEvent(w, False, NoEventMask, e);
+
+    state.waiting = true;
+    state.sent = std::chrono::steady_clock::now();
+    state.timer = addTimer(SYNC_REQUEST_TIMEOUT, [w]() { ResizeSync::instance().caughtUp(w, true); });
+    ++_requests;
+}
+
+bool
+ResizeSync::handleEvent(const XEvent& e) {
+    if (!_available || e.type != _eventBase + XSyncAlarmNotify) {
+        return false;
+    }
+    auto& alarm = reinterpret_cast<const XSyncAlarmNotifyEvent&>(e);
+    for (auto& [w, state] : _states) {
+        if (state.alarm == alarm.alarm) {
+            if (fromSyncValue(alarm.counter_value) >= state.value) {
+                caughtUp(w, false);
+            }
+            break;
+        }
+    }
+    return true;
+}
+
+void
+ResizeSync::caughtUp(Window w, bool timedOut) {
+    auto found = _states.find(w);
+    if (found == _states.end() || !found->second.waiting) {
+        return;
+    }
+    auto& state = found->second;
+    state.waiting = false;
+    if (timedOut) {
+        ++_timeouts;
+        if (++state.timeouts >= SYNC_REQUEST_MAX_TIMEOUTS) {
+            // it says it'll tell us, but it doesn't; stop waiting for it
+            if constexpr (debugActive()) {
+                err("window ", w, " never updates its sync counter, not waiting for it any more");
+            }
+            XSyncDestroyAlarm(DisplayManager::instance().getDisplay(), state.alarm);
+            state.alarm = None;
+            state.counter = None;
+        }
+    } else {
+        cancelTimer(state.timer);
+        state.timeouts = 0;
+        auto latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - state.sent).count();
+        _totalLatency += latency;
+        _worstLatency = std::max(_worstLatency, latency);
+        ++_answered;
+    }
+    if (state.deferred) {
+        auto apply = std::exchange(state.deferred, nullptr);
+        auto resizing = std::exchange(state.deferredResizing, false);
+        if (auto c = state.client.lock(); c && !c->isBeingRemoved()) {
+            configure(c, resizing, std::move(apply));
+        }
+    }
+}
+
+void
+ResizeSync::forget(Window w) {
+    auto found = _states.find(w);
+    if (found == _states.end()) {
+        return;
+    }
+    auto state = std::move(found->second);
+    _states.erase(found);
+    if (state.waiting) {
+        cancelTimer(state.timer);
+    }
+    if (state.alarm) {
+        XSyncDestroyAlarm(DisplayManager::instance().getDisplay(), state.alarm);
+    }
+    // whatever was held back still has to happen, if there's still a client for it to happen to
+    if (state.deferred) {
+        if (auto c = state.client.lock(); c && !c->isBeingRemoved()) {
+            state.deferred();
+        }
+    }
+}
+
+void
+ResizeSync::report() const noexcept {
+    if (!_requests) {
+        return;
+    }
+    err("resize sync: ", _requests, " requests, ", _timeouts, " timed out, ", _deferred, " configures held back, ",
+            _answered ? _totalLatency / _answered : 0.0, "ms average latency (at most ", _worstLatency, "ms)");
+}
@@ -50,6 +50,12 @@ Taskbar::make() noexcept {
     _made = true;
 }
 
+void
+Taskbar::resize() noexcept {
+    auto& dm = DisplayManager::instance();
+    dm.resizeWindow(_taskbar, dm.getWidth(), getBarHeight() - DEF_BORDERWIDTH);
+}
+
 bool
 ClientTracker::accept(std::function<bool(ClientPointer)> fn) {
     auto stop = false;
@@ -99,19 +105,38 @@ Taskbar::leftClick(int x) {
 
     auto& ctracker = ClientTracker::instance();
     auto& dm = DisplayManager::instance();
+    if (grouping()) {
+        auto groups = buildGroups();
+        switch (auto [kind, index] = buttonAt(x, groups.size()); kind) {
+            case ButtonKind::ScrollBack:
+                _firstGroup -= std::min(_firstGroup, layoutGroups(groups.size()).count);
+                redraw();
+                break;
+            case ButtonKind::ScrollForward:
+                _firstGroup += layoutGroups(groups.size()).count;
+                redraw();
+                break;
+            case ButtonKind::Group:
+                clickGroup(groups[index]);
+                break;
+            case ButtonKind::Nothing:
+                break;
+        }
+        return;
+    }
 	if (!ctracker.empty()) {
-        XSetWindowAttributes pattr;
+        auto& pool = WindowPool::instance();
         ctracker.accept([](ClientPointer p) { p->rememberHidden(); return false; });
 
         // unused?
         //auto [mousex, mousey] = getMousePosition();
         Rect bounddims {0, 0, dm.getWidth(), getBarHeight() };
 
-		auto constraint_win = dm.createWindow(bounddims, 0, CopyFromParent, InputOnly, CopyFromParent, 0, pattr);
+		auto constraint_win = pool.acquire(PooledWindow::Constraint, bounddims);
         dm.mapWindow(constraint_win);
 
         if (!(dm.grabPointer(false, MouseMask, GrabModeAsync, GrabModeAsync, constraint_win, None, CurrentTime) == GrabSuccess)) {
-            dm.destroyWindow(constraint_win);
+            pool.release(PooledWindow::Constraint, constraint_win);
 			return;
 		}
 
@@ -146,8 +171,7 @@ Taskbar::leftClick(int x) {
 					break;
 			}
 		} while (ev.type != ButtonPress && ev.type != ButtonRelease && ev.type != KeyPress);
-        dm.unmapWindow(constraint_win);
-        dm.destroyWindow(constraint_win);
+        pool.release(PooledWindow::Constraint, constraint_win);
 		dm.ungrab();
 
         ctracker.accept([](ClientPointer p) { p->forgetHidden(); return false; });
@@ -158,17 +182,17 @@ void
 Taskbar::rightClick(int x) {
 	XEvent ev;
 	unsigned int current_item = UINT_MAX;
-	XSetWindowAttributes pattr;
     auto& dm = DisplayManager::instance();
+    auto& pool = WindowPool::instance();
 
 	//auto [mousex, mousey] = getMousePosition();
 	Rect bounddims { 0, 0, dm.getWidth(), getBarHeight() };
 
-	auto constraint_win = dm.createWindow(bounddims, 0, CopyFromParent, InputOnly, CopyFromParent, 0, pattr);
+	auto constraint_win = pool.acquire(PooledWindow::Constraint, bounddims);
     dm.mapWindow(constraint_win);
 
 	if (!(dm.grabPointer(false, MouseMask, GrabModeAsync, GrabModeAsync, constraint_win, None, CurrentTime) == GrabSuccess)) {
-        dm.destroyWindow(constraint_win);
+        pool.release(PooledWindow::Constraint, constraint_win);
 		return;
 	}
     drawMenubar();
@@ -195,8 +219,7 @@ Taskbar::rightClick(int x) {
 	} while (ev.type != ButtonPress && ev.type != ButtonRelease && ev.type != KeyPress);
 
     Taskbar::instance().redraw();
-    dm.unmapWindow(constraint_win);
-    dm.destroyWindow(constraint_win);
+    pool.release(PooledWindow::Constraint, constraint_win);
 	dm.ungrab();
 }
 
@@ -230,6 +253,11 @@ Taskbar::rightClickRoot() {
 
 void
 Taskbar::redraw() {
+    if (_prompt) {
+        // the prompt covers the whole taskbar for as long as it's open
+        drawPrompt();
+        return;
+    }
 	auto buttonWidth = getButtonWidth();
     auto& dm = DisplayManager::instance();
     dm.clearWindow(_taskbar);
@@ -237,29 +265,180 @@ Taskbar::redraw() {
     if (!_showing) {
 		return;
 	}
+    if (grouping()) {
+        redrawGroups();
+        return;
+    }
 
 	unsigned int i = 0;
     ClientTracker::instance().accept([this, &i, buttonWidth](ClientPointer c) {
-                auto& dm = DisplayManager::instance();
-                auto& ct = ClientTracker::instance();
-		        auto button_startx = static_cast<int>(i * buttonWidth);
-		        auto button_iwidth = static_cast<unsigned int>(((i + 1) * buttonWidth) - button_startx);
-		        if (button_startx != 0) {
-		        	dm.drawLine(_taskbar, border_gc, button_startx - 1, 0, button_startx - 1, getBarHeight() - DEF_BORDERWIDTH);
-		        }
-		        if (c == ct.getFocusedClient()) {
-                    dm.fillRectangle(_taskbar, active_gc, button_startx, 0, button_iwidth, getBarHeight() - DEF_BORDERWIDTH);
-		        } else {
-                    dm.fillRectangle(_taskbar, inactive_gc, button_startx, 0, button_iwidth, getBarHeight() - DEF_BORDERWIDTH);
-		        }
-		        if (!c->getTrans() && c->getName()) {
-                    drawString(_tbxftdraw, &xft_detail, xftfont, button_startx + SPACE, SPACE + xftfont->ascent, *(c->getName()));
-		        }
+                drawButton(i, c, buttonWidth);
                 ++i;
                 return false;
             });
 }
 
+void
+Taskbar::drawButton(unsigned int i, ClientPointer c, float buttonWidth) {
+    auto& dm = DisplayManager::instance();
+    auto& ct = ClientTracker::instance();
+    auto button_startx = static_cast<int>(i * buttonWidth);
+    auto button_iwidth = static_cast<unsigned int>(((i + 1) * buttonWidth) - button_startx);
+    if (button_startx != 0) {
+        dm.drawLine(_taskbar, border_gc, button_startx - 1, 0, button_startx - 1, getBarHeight() - DEF_BORDERWIDTH);
+    }
+    if (c == _highlighted) {
+        dm.fillRectangle(_taskbar, selected_gc, button_startx, 0, button_iwidth, getBarHeight() - DEF_BORDERWIDTH);
+    } else if (c == ct.getFocusedClient()) {
+        dm.fillRectangle(_taskbar, active_gc, button_startx, 0, button_iwidth, getBarHeight() - DEF_BORDERWIDTH);
+    } else {
+        dm.fillRectangle(_taskbar, inactive_gc, button_startx, 0, button_iwidth, getBarHeight() - DEF_BORDERWIDTH);
+    }
+    if (!c->getTrans() && c->getName()) {
+        c->getTaskbarTitle().get(xftfont, *(c->getName()), button_iwidth - (SPACE * 2)).draw(_tbxftdraw, &xft_detail, button_startx + SPACE, getTextBaseline());
+    }
+}
+
+bool
+Taskbar::grouping() noexcept {
+    return getButtonWidth() < MIN_TASKBAR_BUTTON_WIDTH;
+}
+
+/* Clients with the same class go together, then those in the same
+ * window group, and anything else gets a group of its own. Groups come
+ * in the order their first member appears in the client list so that
+ * they don't jump about. */
+std::vector<Taskbar::Group>
+Taskbar::buildGroups() const {
+    std::vector<Group> groups;
+    std::map<std::string, std::size_t> byKey;
+    ClientTracker::instance().accept([&groups, &byKey](ClientPointer c) {
+                std::string key;
+                if (c->getClass()) {
+                    key = *c->getClass();
+                } else if (c->getGroup() != None) {
+                    key = "\x01group " + std::to_string(c->getGroup());
+                } else {
+                    key = "\x01window " + std::to_string(c->getWindow());
+                }
+                if (auto loc = byKey.find(key); loc != byKey.end()) {
+                    groups[loc->second].members.emplace_back(c);
+                } else {
+                    byKey.emplace(key, groups.size());
+                    groups.push_back({ key, { c } });
+                }
+                return false;
+            });
+    return groups;
+}
+
+Taskbar::GroupLayout
+Taskbar::layoutGroups(std::size_t groupCount) noexcept {
+    GroupLayout layout;
+    int available = DisplayManager::instance().getWidth() + DEF_BORDERWIDTH;
+    if (groupCount == 0) {
+        return layout;
+    }
+    if (static_cast<int>(groupCount) * TASKBAR_GROUP_WIDTH > available) {
+        layout.arrowWidth = getTitleButtonWidth();
+        available -= layout.arrowWidth * 2;
+        layout.count = std::max(1, available / TASKBAR_GROUP_WIDTH);
+        _firstGroup = std::min(_firstGroup, groupCount - layout.count);
+    } else {
+        layout.count = groupCount;
+        _firstGroup = 0;
+    }
+    layout.first = _firstGroup;
+    layout.width = static_cast<float>(available) / layout.count;
+    return layout;
+}
+
+std::tuple<Taskbar::ButtonKind, std::size_t>
+Taskbar::buttonAt(int x, std::size_t groupCount) noexcept {
+    auto layout = layoutGroups(groupCount);
+    auto width = DisplayManager::instance().getWidth() + DEF_BORDERWIDTH;
+    if (layout.count == 0) {
+        return std::make_tuple(ButtonKind::Nothing, 0);
+    }
+    if (x < layout.arrowWidth) {
+        return std::make_tuple(ButtonKind::ScrollBack, 0);
+    }
+    if (x >= width - layout.arrowWidth) {
+        return std::make_tuple(ButtonKind::ScrollForward, 0);
+    }
+    auto index = static_cast<std::size_t>((x - layout.arrowWidth) / layout.width);
+    if (index >= layout.count) {
+        return std::make_tuple(ButtonKind::Nothing, 0);
+    }
+    return std::make_tuple(ButtonKind::Group, layout.first + index);
+}
+
+/* Only the groups which are on screen get drawn, so this costs the
+ * same however many clients there are. */
+void
+Taskbar::redrawGroups() {
+    auto& dm = DisplayManager::instance();
+    auto& ct = ClientTracker::instance();
+    auto groups = buildGroups();
+    auto layout = layoutGroups(groups.size());
+    auto barHeight = getBarHeight() - DEF_BORDERWIDTH;
+    if (layout.arrowWidth) {
+        auto drawArrow = [this, &dm, barHeight](int x, const std::string& arrow, bool enabled) {
+            dm.fillRectangle(_taskbar, enabled ? menu_gc : inactive_gc, x, 0, getTitleButtonWidth(), barHeight);
+            drawString(_tbxftdraw, &xft_detail, xftfont, x + SPACE, getTextBaseline(), arrow);
+        };
+        drawArrow(0, "<", layout.first > 0);
+        drawArrow(dm.getWidth() + DEF_BORDERWIDTH - layout.arrowWidth, ">", layout.first + layout.count < groups.size());
+    }
+    for (std::size_t i = 0; i < layout.count; ++i) {
+        const auto& group = groups[layout.first + i];
+        auto startx = layout.arrowWidth + static_cast<int>(i * layout.width);
+        auto width = static_cast<unsigned int>(layout.arrowWidth + static_cast<int>((i + 1) * layout.width) - startx);
+        if (startx != 0) {
+            dm.drawLine(_taskbar, border_gc, startx - 1, 0, startx - 1, barHeight);
+        }
+        auto contains = [&group](const ClientPointer& c) { return c && std::find(group.members.begin(), group.members.end(), c) != group.members.end(); };
+        GC gc = inactive_gc;
+        if (contains(_highlighted)) {
+            gc = selected_gc;
+        } else if (contains(ct.getFocusedClient())) {
+            gc = active_gc;
+        }
+        dm.fillRectangle(_taskbar, gc, startx, 0, width, barHeight);
+        std::string label;
+        if (group.members.size() == 1 || !group.members.front()->getClass()) {
+            label = group.members.front()->getName().value_or("");
+        } else {
+            label = *group.members.front()->getClass();
+        }
+        if (group.members.size() > 1) {
+            label = "[" + std::to_string(group.members.size()) + "] " + label;
+        }
+        GlyphRun::layout(xftfont, label, width - (SPACE * 2)).draw(_tbxftdraw, &xft_detail, startx + SPACE, getTextBaseline());
+    }
+}
+
+/* A group with one client in it acts just like an ordinary taskbar
+ * button. Clicking a bigger one switches to the member after the
+ * focused one (or the most recently used if none of them has focus),
+ * so repeated clicks go round the group. */
+void
+Taskbar::clickGroup(const Group& group) {
+    auto& ct = ClientTracker::instance();
+    if (group.members.size() == 1) {
+        lclick_taskbutton(nullptr, group.members.front());
+        return;
+    }
+    auto& members = group.members;
+    ClientPointer next;
+    if (auto focused = std::find(members.begin(), members.end(), ct.getFocusedClient()); focused != members.end()) {
+        next = (std::next(focused) == members.end()) ? members.front() : *std::next(focused);
+    } else {
+        next = *std::max_element(members.begin(), members.end(), [](const ClientPointer& a, const ClientPointer& b) { return a->getFocusOrder() < b->getFocusOrder(); });
+    }
+    ct.switchTo(next);
+}
+
 void 
 Taskbar::drawMenubar() {
     auto& dm = DisplayManager::instance();
@@ -267,7 +446,7 @@ Taskbar::drawMenubar() {
 
     for (auto& menuItem : Menu::instance()) {
         if (!menuItem->isEmpty()) {
-            drawString(_tbxftdraw, &xft_detail, xftfont, menuItem->getX() + (SPACE * 2), xftfont->ascent + SPACE, menuItem->getLabel());
+            drawString(_tbxftdraw, &xft_detail, xftfont, menuItem->getX() + (SPACE * 2), getTextBaseline(), menuItem->getLabel());
 		}
 	}
 }
@@ -280,13 +459,7 @@ Taskbar::updateMenuItem (int mousex) {
         last_item = menu.size();
 		return UINT_MAX;
 	}
-	unsigned int i = 0;
-    for (const auto& menuItem : menu) {
-		if ((mousex >= menuItem->getX()) && (mousex <= (menuItem->getX() + menuItem->getWidth()))) {
-			break;
-		}
-        ++i;
-	}
+	unsigned int i = menu.itemAt(mousex);
 
 	if (i != last_item) /* don't redraw if same */ {
 		if (last_item != menu.size()) {
@@ -317,7 +490,7 @@ Taskbar::drawMenuItem(unsigned int index, bool active) {
         } else {
             dm.fillRectangle(_taskbar, menu_gc, x, 0, width, getBarHeight() - DEF_BORDERWIDTH);
         }
-        drawString(_tbxftdraw, &xft_detail, xftfont,x + (SPACE * 2), xftfont->ascent + SPACE, menuItem->getLabel());
+        drawString(_tbxftdraw, &xft_detail, xftfont,x + (SPACE * 2), getTextBaseline(), menuItem->getLabel());
     }
 }
 
@@ -362,3 +535,336 @@ Taskbar::cycleNext() {
         lclick_taskbutton(nullptr, c);
 	}
 }
+
+void
+Taskbar::drawPrompt() {
+    auto& dm = DisplayManager::instance();
+    auto barHeight = getBarHeight() - DEF_BORDERWIDTH;
+    dm.fillRectangle(_taskbar, menu_gc, 0, 0, dm.getWidth(), barHeight);
+    auto text = _prompt->label + " " + _prompt->query + "_";
+    drawString(_tbxftdraw, &xft_detail, xftfont, SPACE * 2, getTextBaseline(), text);
+    // keep the results from jumping about as the query gets longer
+    auto x = std::max(textWidth(xftfont, text) + (SPACE * 4), dm.getWidth() / 4);
+    const auto& results = _prompt->results;
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        auto width = textWidth(xftfont, results[i]) + (SPACE * 4);
+        if (x + width > dm.getWidth()) {
+            break;
+        }
+        if (i == _prompt->selected) {
+            dm.fillRectangle(_taskbar, selected_gc, x, 0, width, barHeight);
+        }
+        drawString(_tbxftdraw, &xft_detail, xftfont, x + (SPACE * 2), getTextBaseline(), results[i]);
+        x += width + 1;
+    }
+}
+
+void
+Taskbar::prompt(const std::string& label, PromptSearch search, PromptDone done) {
+    auto& dm = DisplayManager::instance();
+    if (_prompt || _cycle || !dm.grabKeyboard(_taskbar)) {
+        done(std::nullopt);
+        return;
+    }
+    _prompt.emplace();
+    _prompt->label = label;
+    _prompt->search = std::move(search);
+    _prompt->done = std::move(done);
+    _prompt->results = _prompt->search(_prompt->query);
+    drawPrompt();
+}
+
+void
+Taskbar::refreshPrompt() {
+    if (!_prompt) {
+        return;
+    }
+    // stay on whatever was selected, if it's still there
+    auto& results = _prompt->results;
+    auto selected = results.empty() ? std::string() : results[_prompt->selected];
+    results = _prompt->search(_prompt->query);
+    auto loc = std::find(results.begin(), results.end(), selected);
+    _prompt->selected = (loc == results.end()) ? 0 : std::distance(results.begin(), loc);
+    drawPrompt();
+}
+
+void
+Taskbar::finishPrompt(std::optional<PromptResult> result) {
+    auto done = std::move(_prompt->done);
+    _prompt.reset();
+    DisplayManager::instance().ungrabKeyboard();
+    redraw();
+    done(result);
+}
+
+bool
+Taskbar::keyPress(XKeyEvent& e) {
+    if (_cycle) {
+        switch (DisplayManager::instance().keycodeToKeysym(e.keycode)) {
+            case KEY_CYCLEPREV:
+                stepCycle(!(e.state & ShiftMask));
+                break;
+            case KEY_CYCLENEXT:
+                stepCycle(false);
+                break;
+            case XK_Escape:
+                finishCycle(false);
+                break;
+        }
+        return true;
+    }
+    if (!_prompt) {
+        return false;
+    }
+    char buf[32];
+    KeySym keysym;
+    auto len = XLookupString(&e, buf, sizeof buf, &keysym, nullptr);
+    auto& query = _prompt->query;
+    auto& results = _prompt->results;
+    auto& selected = _prompt->selected;
+    auto queryChanged = false;
+    switch (keysym) {
+        case XK_Escape:
+            finishPrompt(std::nullopt);
+            return true;
+        case XK_Return:
+        case XK_KP_Enter:
+            finishPrompt(PromptResult { results.empty() ? std::nullopt : std::optional<std::size_t>(selected), query });
+            return true;
+        case XK_BackSpace:
+            // take off a whole UTF-8 character
+            while (!query.empty() && (query.back() & 0xC0) == 0x80) {
+                query.pop_back();
+            }
+            if (!query.empty()) {
+                query.pop_back();
+            }
+            queryChanged = true;
+            break;
+        case XK_Tab:
+        case XK_Right:
+        case XK_Down:
+            if (!results.empty()) {
+                selected = (selected + 1) % results.size();
+            }
+            break;
+        case XK_ISO_Left_Tab:
+        case XK_Left:
+        case XK_Up:
+            if (!results.empty()) {
+                selected = (selected + results.size() - 1) % results.size();
+            }
+            break;
+        default:
+            if ((e.state & ControlMask) && keysym == XK_u) {
+                query.clear();
+                queryChanged = true;
+            } else if (len > 0 && !std::iscntrl(static_cast<unsigned char>(buf[0]))) {
+                query.append(buf, len);
+                queryChanged = true;
+            }
+            break;
+    }
+    if (queryChanged) {
+        results = _prompt->search(query);
+        selected = 0;
+    }
+    drawPrompt();
+    return true;
+}
+
+bool
+Taskbar::keyRelease(const XKeyEvent& e) {
+    if (!_cycle) {
+        return false;
+    }
+    if (DisplayManager::instance().isModifierKeycode(e.keycode)) {
+        finishCycle(true);
+    }
+    return true;
+}
+
+void
+Taskbar::cancelKeyboardGrab() {
+    if (_prompt) {
+        finishPrompt(std::nullopt);
+    } else if (_cycle) {
+        finishCycle(false);
+    }
+}
+
+void
+Taskbar::launcher() {
+    struct State {
+        std::vector<FuzzyIndex::Match> matches;
+    };
+    auto state = std::make_shared<State>();
+    // only the command name is searched for, anything after it is passed along as arguments
+    prompt("run:", [state](const std::string& query) {
+                auto& paths = PathIndex::instance();
+                auto start = std::chrono::steady_clock::now();
+                state->matches = paths.search(std::string_view(query).substr(0, query.find(' ')), MAX_PROMPT_RESULTS, []() { Taskbar::instance().refreshPrompt(); });
+                if constexpr (debugActive()) {
+                    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+                    err("searched ", paths.size(), " executables for \"", query, "\" in ", elapsed.count(), "ms");
+                }
+                std::vector<std::string> labels;
+                for (const auto& match : state->matches) {
+                    labels.emplace_back(paths.at(match.index));
+                }
+                return labels;
+            },
+            [state](std::optional<PromptResult> result) {
+                auto& paths = PathIndex::instance();
+                if (!result) {
+                    return;
+                }
+                if (result->selected) {
+                    auto arguments = result->query.find(' ');
+                    forkExec(paths.at(state->matches[*result->selected].index) + (arguments == std::string::npos ? std::string() : result->query.substr(arguments)));
+                } else if (!result->query.empty()) {
+                    forkExec(result->query);
+                }
+            });
+}
+
+// longest window title we show in the switcher, in bytes
+constexpr std::size_t MAX_SWITCHER_LABEL = 48;
+
+void
+Taskbar::switcher() {
+    auto& ctracker = ClientTracker::instance();
+    if (ctracker.empty()) {
+        return;
+    }
+    struct State {
+        // most recently focused first, so that the index breaks ties between equally good matches
+        std::vector<ClientPointer> clients;
+        FuzzyIndex titles;
+        std::vector<std::string> labels;
+        std::vector<FuzzyIndex::Match> matches;
+    };
+    auto state = std::make_shared<State>();
+    state->clients = ctracker.byRecentFocus();
+    state->labels.reserve(state->clients.size());
+    std::size_t bytes = 0;
+    for (const auto& c : state->clients) {
+        auto label = c->getName().value_or("");
+        if (c->getClass()) {
+            label += " (" + *c->getClass() + ")";
+        }
+        bytes += label.size();
+        state->labels.emplace_back(std::move(label));
+    }
+    state->titles.reserve(state->clients.size(), bytes);
+    for (const auto& label : state->labels) {
+        state->titles.add(label);
+    }
+    prompt("window:", [state](const std::string& query) {
+                state->matches = state->titles.search(query, MAX_PROMPT_RESULTS);
+                std::vector<std::string> shown;
+                for (const auto& match : state->matches) {
+                    auto label = state->labels[match.index];
+                    if (label.size() > MAX_SWITCHER_LABEL) {
+                        // don't cut a UTF-8 character in half
+                        auto end = MAX_SWITCHER_LABEL;
+                        while (end > 0 && (label[end] & 0xC0) == 0x80) {
+                            --end;
+                        }
+                        label = label.substr(0, end) + "...";
+                    }
+                    shown.emplace_back(std::move(label));
+                }
+                return shown;
+            },
+            [state](std::optional<PromptResult> result) {
+                auto& ctracker = ClientTracker::instance();
+                if (!result || !result->selected) {
+                    return;
+                }
+                auto c = state->clients[state->matches[*result->selected].index];
+                // the client may well have gone away while the prompt was open
+                if (ctracker.find(c) == ctracker.end() || c->isBeingRemoved()) {
+                    return;
+                }
+                ctracker.switchTo(c);
+            });
+}
+
+void
+Taskbar::highlight(ClientPointer c) {
+    auto previous = _highlighted;
+    _highlighted = c;
+    redrawButtons(previous, c);
+}
+
+void
+Taskbar::focusChanged(ClientPointer previous, ClientPointer current) {
+    redrawButtons(previous, current);
+}
+
+void
+Taskbar::redrawButtons(ClientPointer first, ClientPointer second) {
+    auto& ctracker = ClientTracker::instance();
+    if (!_showing || _prompt) {
+        return;
+    }
+    if (grouping()) {
+        // bounded by the screen width anyway
+        redraw();
+        return;
+    }
+    auto buttonWidth = getButtonWidth();
+    for (auto& changed : { first, second }) {
+        if (auto pos = ctracker.find(changed); changed && pos != ctracker.end()) {
+            drawButton(std::distance(ctracker.begin(), pos), changed, buttonWidth);
+        }
+    }
+}
+
+void
+Taskbar::cycleRecent(bool forward) {
+    auto& ctracker = ClientTracker::instance();
+    auto& dm = DisplayManager::instance();
+    if (ctracker.size() < 2 || _prompt || _cycle) {
+        return;
+    }
+    auto clients = ctracker.byRecentFocus();
+    std::size_t current = forward ? 1 : clients.size() - 1;
+    // without a modifier to hold there is nothing to wait for, and if it was let go before we got here it's too late
+    if (MODIFIER == 0 || !dm.grabKeyboard(dm.getRoot()) || !(dm.queryModifierState() & MODIFIER)) {
+        dm.ungrabKeyboard();
+        ctracker.switchTo(clients[current]);
+        return;
+    }
+    // the keys come back to us through keyPress() and keyRelease() until the modifier is let go
+    _cycle = Cycle { std::move(clients), current };
+    highlight(_cycle->clients[current]);
+}
+
+void
+Taskbar::stepCycle(bool forward) {
+    auto& ctracker = ClientTracker::instance();
+    auto& clients = _cycle->clients;
+    auto& current = _cycle->current;
+    // skip over anything that has gone away since the cycle started
+    for (std::size_t tried = 0; tried < clients.size(); ++tried) {
+        current = forward ? (current + 1) % clients.size() : (current + clients.size() - 1) % clients.size();
+        if (ctracker.find(clients[current]) != ctracker.end() && !clients[current]->isBeingRemoved()) {
+            break;
+        }
+    }
+    highlight(clients[current]);
+}
+
+void
+Taskbar::finishCycle(bool commit) {
+    auto& ctracker = ClientTracker::instance();
+    auto chosen = _cycle->clients[_cycle->current];
+    _cycle.reset();
+    DisplayManager::instance().ungrabKeyboard();
+    highlight(nullptr);
+    if (commit && ctracker.find(chosen) != ctracker.end() && !chosen->isBeingRemoved()) {
+        ctracker.switchTo(chosen);
+    }
+}
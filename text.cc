@@ -0,0 +1,317 @@
+/* WindowLab17 - An X11 window manager based off of windowlab but rewritten in C++17
+ * Based off of "WindowLab - an X11 window manager by Nick Gravgaard"
+ *
+ * WindowLab17 Copyright (c) 2020 Joshua Scoggins
+ * WindowLab Copyright (c) 2001-2010 Nick Gravgaard
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include <unordered_map>
+#include "windowlab.h"
+
+/* The fonts we draw with: the main one and any fallbacks we've had to
+ * find for characters it doesn't have. Each font remembers the advance
+ * of every glyph we've asked about so that laying out the same
+ * characters again doesn't go back to Xft. Everything is thrown away
+ * if the main font changes. */
+namespace {
+    struct FontEntry {
+        XftFont* font;
+        std::unordered_map<FT_UInt, int> advances;
+    };
+    class FontSet final {
+        public:
+            static FontSet& instance(XftFont* primary) noexcept;
+            /**
+             * Which font to draw ch with, nullptr if nothing we can find has it.
+             */
+            FontEntry* fontFor(FcChar32 ch);
+            int advance(FontEntry& entry, FT_UInt glyph) noexcept;
+        private:
+            FontEntry* findFallback(FcChar32 ch);
+            void reset(XftFont* primary) noexcept;
+        private:
+            std::vector<std::unique_ptr<FontEntry>> _fonts;
+            std::unordered_map<FcChar32, FontEntry*> _fallbacks;
+    };
+}
+
+FontSet&
+FontSet::instance(XftFont* primary) noexcept {
+    static FontSet _set;
+    if (_set._fonts.empty() || _set._fonts.front()->font != primary) {
+        _set.reset(primary);
+    }
+    return _set;
+}
+
+void
+FontSet::reset(XftFont* primary) noexcept {
+    auto display = DisplayManager::instance().getDisplay();
+    for (std::size_t i = 1; i < _fonts.size(); ++i) {
+        XftFontClose(display, _fonts[i]->font);
+    }
+    _fonts.clear();
+    _fallbacks.clear();
+    _fonts.emplace_back(new FontEntry { primary, {} });
+}
+
+FontEntry*
+FontSet::fontFor(FcChar32 ch) {
+    auto display = DisplayManager::instance().getDisplay();
+    if (XftCharExists(display, _fonts.front()->font, ch)) {
+        return _fonts.front().get();
+    }
+    if (auto loc = _fallbacks.find(ch); loc != _fallbacks.end()) {
+        return loc->second;
+    }
+    auto entry = findFallback(ch);
+    _fallbacks.emplace(ch, entry);
+    return entry;
+}
+
+/* Try the fallbacks we already have before asking fontconfig, since a
+ * title in a script the main font lacks tends to need a lot of
+ * characters from the same place. */
+FontEntry*
+FontSet::findFallback(FcChar32 ch) {
+    auto& dm = DisplayManager::instance();
+    auto display = dm.getDisplay();
+    for (std::size_t i = 1; i < _fonts.size(); ++i) {
+        if (XftCharExists(display, _fonts[i]->font, ch)) {
+            return _fonts[i].get();
+        }
+    }
+    // ask for something like the main font (same size, weight and so on) which has this character
+    auto pattern = FcPatternDuplicate(_fonts.front()->font->pattern);
+    if (!pattern) {
+        return nullptr;
+    }
+    for (auto property : { FC_FAMILY, FC_FILE, FC_INDEX, FC_CHARSET }) {
+        FcPatternDel(pattern, property);
+    }
+    auto charset = FcCharSetCreate();
+    FcCharSetAddChar(charset, ch);
+    FcPatternAddCharSet(pattern, FC_CHARSET, charset);
+    FcCharSetDestroy(charset);
+    FcConfigSubstitute(nullptr, pattern, FcMatchPattern);
+    XftDefaultSubstitute(display, dm.getScreen(), pattern);
+    FcResult result;
+    auto match = FcFontMatch(nullptr, pattern, &result);
+    FcPatternDestroy(pattern);
+    if (!match) {
+        return nullptr;
+    }
+    auto font = XftFontOpenPattern(display, match);
+    if (!font) {
+        FcPatternDestroy(match);
+        return nullptr;
+    }
+    if (!XftCharExists(display, font, ch)) {
+        // the best match doesn't have it either, so nothing does
+        XftFontClose(display, font);
+        return nullptr;
+    }
+    _fonts.emplace_back(new FontEntry { font, {} });
+    return _fonts.back().get();
+}
+
+int
+FontSet::advance(FontEntry& entry, FT_UInt glyph) noexcept {
+    if (auto loc = entry.advances.find(glyph); loc != entry.advances.end()) {
+        return loc->second;
+    }
+    XGlyphInfo extents;
+    XftGlyphExtents(DisplayManager::instance().getDisplay(), entry.font, &glyph, 1, &extents);
+    entry.advances.emplace(glyph, extents.xOff);
+    return extents.xOff;
+}
+
+GlyphRun
+GlyphRun::layout(XftFont* font, const std::string& text, int maxWidth) {
+    GlyphRun run;
+    if (!font || text.empty()) {
+        return run;
+    }
+    auto display = DisplayManager::instance().getDisplay();
+    auto& fonts = FontSet::instance(font);
+    // where each glyph ends, so that we know where to cut for the ellipsis
+    std::vector<int> ends;
+    auto addGlyph = [&run, &ends, &fonts, display](FcChar32 ch) {
+        auto entry = fonts.fontFor(ch);
+        if (!entry) {
+            // let the main font draw whatever it draws for a missing glyph
+            entry = fonts.fontFor(0xFFFD);
+            if (!entry) {
+                entry = fonts.fontFor('?');
+            }
+            if (!entry) {
+                return;
+            }
+        }
+        auto glyph = XftCharIndex(display, entry->font, ch);
+        run._glyphs.push_back({ entry->font, glyph, static_cast<short>(run._width), 0 });
+        run._width += fonts.advance(*entry, glyph);
+        ends.emplace_back(run._width);
+    };
+    auto bytes = reinterpret_cast<const FcChar8*>(text.data());
+    int remaining = text.size();
+    while (remaining > 0) {
+        FcChar32 ch;
+        auto used = FcUtf8ToUcs4(bytes, &ch, remaining);
+        if (used <= 0) {
+            // not valid UTF-8, so take it as Latin-1 like XFetchName would have given us
+            ch = *bytes;
+            used = 1;
+        }
+        bytes += used;
+        remaining -= used;
+        if (ch < 0x20) {
+            continue;
+        }
+        addGlyph(ch);
+    }
+    if (run._width <= maxWidth) {
+        return run;
+    }
+    // too wide, so work out how much fits alongside an ellipsis
+    GlyphRun ellipsis = layout(font, "…");
+    if (ellipsis.empty() || ellipsis._glyphs.front().glyph == 0) {
+        ellipsis = layout(font, "...");
+    }
+    auto keep = std::upper_bound(ends.begin(), ends.end(), maxWidth - ellipsis._width) - ends.begin();
+    run._glyphs.resize(keep);
+    run._width = keep ? ends[keep - 1] : 0;
+    if (run._width + ellipsis._width <= maxWidth) {
+        for (auto glyph : ellipsis._glyphs) {
+            glyph.x += run._width;
+            run._glyphs.push_back(glyph);
+        }
+        run._width += ellipsis._width;
+    }
+    return run;
+}
+
+void
+GlyphRun::draw(XftDraw* d, XftColor* color, int x, int y) noexcept {
+    if (_glyphs.empty()) {
+        return;
+    }
+    // move the glyphs to where they are wanted this time; usually that is where they were last time
+    if (x != _x || y != _y) {
+        for (auto& glyph : _glyphs) {
+            glyph.x += x - _x;
+            glyph.y += y - _y;
+        }
+        _x = x;
+        _y = y;
+    }
+    XftDrawGlyphFontSpec(d, color, _glyphs.data(), _glyphs.size());
+}
+
+bool
+GlyphRun::sameGlyphs(const GlyphRun& other) const noexcept {
+    return _width == other._width && std::equal(_glyphs.begin(), _glyphs.end(), other._glyphs.begin(), other._glyphs.end(),
+            [](const XftGlyphFontSpec& a, const XftGlyphFontSpec& b) { return a.font == b.font && a.glyph == b.glyph; });
+}
+
+bool
+CachedGlyphRun::update(const std::string& text) {
+    if (!_font) {
+        return true;
+    }
+    if (text == *_text) {
+        return false;
+    }
+    auto run = GlyphRun::layout(_font, text, _maxWidth);
+    auto changed = !run.sameGlyphs(_run);
+    _run = std::move(run);
+    _text = text;
+    return changed;
+}
+
+GlyphRun&
+CachedGlyphRun::get(XftFont* font, const std::string& text, int maxWidth) {
+    if (font != _font || maxWidth != _maxWidth || text != *_text) {
+        _run = GlyphRun::layout(font, text, maxWidth);
+        _font = font;
+        _text = text;
+        _maxWidth = maxWidth;
+    }
+    return _run;
+}
+
+StringArena&
+StringArena::instance() noexcept {
+    // never destroyed, since clients (holding InternedStrings) can outlive any static of ours
+    static StringArena* arena = new StringArena();
+    return *arena;
+}
+
+StringArena::StringArena() {
+    _entries.emplace_back();
+}
+
+std::uint32_t
+StringArena::intern(std::string_view text) {
+    if (auto found = _index.find(text); found != _index.end()) {
+        ++_entries[found->second].refs;
+        return found->second;
+    }
+    std::uint32_t id;
+    if (!_free.empty()) {
+        id = _free.back();
+        _free.pop_back();
+    } else {
+        id = static_cast<std::uint32_t>(_entries.size());
+        _entries.emplace_back();
+    }
+    auto& entry = _entries[id];
+    entry.text.assign(text);
+    entry.refs = 1;
+    _index.emplace(entry.text, id);
+    return id;
+}
+
+void
+StringArena::retain(std::uint32_t id) noexcept {
+    if (id) {
+        ++_entries[id].refs;
+    }
+}
+
+void
+StringArena::release(std::uint32_t id) noexcept {
+    if (id && --_entries[id].refs == 0) {
+        auto& entry = _entries[id];
+        _index.erase(entry.text);
+        std::string().swap(entry.text);
+        _free.push_back(id);
+    }
+}
+
+std::tuple<std::size_t, std::size_t>
+StringArena::usage() const noexcept {
+    // each string's own bytes, plus its entry and its slot in the index
+    std::size_t bytes = _entries.size() * sizeof(Entry) + _index.size() * (sizeof(std::string_view) + sizeof(std::uint32_t) + sizeof(void*));
+    for (auto& entry : _entries) {
+        if (entry.refs && entry.text.capacity() > std::string().capacity()) {
+            bytes += entry.text.capacity() + 1;
+        }
+    }
+    return { _entries.size() - 1 - _free.size(), bytes };
+}
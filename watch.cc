@@ -0,0 +1,106 @@
+/* WindowLab17 - An X11 window manager based off of windowlab but rewritten in C++17
+ * Based off of "WindowLab - an X11 window manager by Nick Gravgaard"
+ *
+ * WindowLab17 Copyright (c) 2020 Joshua Scoggins
+ * WindowLab Copyright (c) 2001-2010 Nick Gravgaard
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <sys/inotify.h>
+#include <fcntl.h>
+#include "windowlab.h"
+
+FileWatcher&
+FileWatcher::instance() noexcept {
+    static FileWatcher _watcher;
+    return _watcher;
+}
+
+int
+FileWatcher::watchDirectory(const std::filesystem::path& dir, std::uint32_t mask, Callback fn) noexcept {
+    if (_fd == -1) {
+        _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (_fd == -1) {
+            err("inotify_init1 failed: ", strerror(errno));
+            return -1;
+        }
+        addEventSource(_fd, []() { FileWatcher::instance().dispatch(); });
+    }
+    // add to the mask rather than replacing it in case someone else is already watching this directory
+    int wd = inotify_add_watch(_fd, dir.c_str(), mask | IN_MASK_ADD);
+    if (wd == -1) {
+        if constexpr (debugActive()) {
+            err("can't watch ", dir, ": ", strerror(errno));
+        }
+        return -1;
+    }
+    auto handle = _nextHandle++;
+    _watches[wd][handle] = fn;
+    _handles[handle] = wd;
+    return handle;
+}
+
+void
+FileWatcher::unwatch(int handle) noexcept {
+    if (auto loc = _handles.find(handle); loc != _handles.end()) {
+        auto wd = loc->second;
+        _handles.erase(loc);
+        if (auto watch = _watches.find(wd); watch != _watches.end()) {
+            watch->second.erase(handle);
+            if (watch->second.empty()) {
+                inotify_rm_watch(_fd, wd);
+                _watches.erase(watch);
+            }
+        }
+    }
+}
+
+/* Read everything inotify has for us and hand each event to the
+ * callback for its watch. Callbacks get the name of the directory
+ * entry that changed (empty if the change was to the directory
+ * itself). */
+void
+FileWatcher::dispatch() noexcept {
+    alignas(inotify_event) char buf[4096];
+    for (;;) {
+        auto len = read(_fd, buf, sizeof buf);
+        if (len <= 0) {
+            return;
+        }
+        for (char* ptr = buf; ptr < buf + len; ) {
+            auto event = reinterpret_cast<inotify_event*>(ptr);
+            ptr += sizeof(inotify_event) + event->len;
+            if (event->mask & IN_IGNORED) {
+                // the watch went away along with whatever it was watching
+                if (auto loc = _watches.find(event->wd); loc != _watches.end()) {
+                    for (const auto& [handle, fn] : loc->second) {
+                        _handles.erase(handle);
+                    }
+                    _watches.erase(loc);
+                }
+                continue;
+            }
+            if (auto loc = _watches.find(event->wd); loc != _watches.end()) {
+                // copy the callbacks since they are allowed to unwatch themselves
+                auto callbacks = loc->second;
+                std::string name = event->len ? std::string(event->name) : std::string();
+                for (const auto& [handle, fn] : callbacks) {
+                    fn(name);
+                }
+            }
+        }
+    }
+}
@@ -26,6 +26,7 @@
 #define RELEASEDATE "2020-03-03"
 
 #include <cerrno>
+#include <csignal>
 #include <climits>
 #include <pwd.h>
 #include <cstdio>
@@ -42,6 +43,20 @@
 #include <filesystem>
 #include <iostream>
 #include <functional>
+#include <optional>
+#include <memory>
+#include <tuple>
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <map>
+#include <deque>
+#include <cstdint>
+#include <chrono>
+#include <string_view>
+#include <array>
+#include <utility>
+#include <unordered_map>
 #include <X11/extensions/shape.h>
 #include <X11/Xft/Xft.h>
 #include <X11/XKBlib.h>
@@ -60,9 +75,15 @@
 #define DEF_MENU "#ddd"
 #define DEF_SELECTED "#aad"
 #define DEF_EMPTY "#000"
+
+// how long (in seconds) a window has to stay hidden before its frame is given up; 0 means never
+#define DEF_RECLAIM 600
 constexpr auto DEF_BORDERWIDTH = 2;
 constexpr auto ACTIVE_SHADOW = 0x2000; // eg #fff becomes #ddd
 constexpr auto SPACE = 3;
+// in progressive startup mode, lay things out as if the font were this size until the real one has loaded
+constexpr auto PROVISIONAL_FONT_ASCENT = 11;
+constexpr auto PROVISIONAL_FONT_DESCENT = 3;
 
 // change MODIFIER to None to remove the need to hold down a modifier key
 // the Windows key should be Mod4Mask and the Alt key is Mod1Mask
@@ -73,6 +94,31 @@ constexpr auto KEY_CYCLEPREV = XK_Tab;
 constexpr auto KEY_CYCLENEXT = XK_q;
 constexpr auto KEY_FULLSCREEN = XK_F11;
 constexpr auto KEY_TOGGLEZ = XK_F12;
+constexpr auto KEY_LAUNCHER = XK_F2;
+constexpr auto KEY_SWITCHER = XK_F3;
+// most matches to show at once when the taskbar is being used as a prompt
+constexpr auto MAX_PROMPT_RESULTS = 32;
+// once taskbar buttons would get narrower than this, windows are grouped by class instead
+constexpr auto MIN_TASKBAR_BUTTON_WIDTH = 48;
+// how wide each group's button is when grouping
+constexpr auto TASKBAR_GROUP_WIDTH = 160;
+// the most often we pick up title changes (about once a frame at 60Hz)
+constexpr auto TITLE_UPDATE_INTERVAL = std::chrono::milliseconds(16);
+// how many created-but-not-yet-mapped windows we read ahead for
+constexpr std::size_t MAX_SPECULATIVE_PREFETCHES = 64;
+// the most idle windows of each kind the window pool holds on to, and for how long
+constexpr std::size_t MAX_POOLED_WINDOWS = 8;
+constexpr auto POOLED_WINDOW_IDLE_TIME = std::chrono::seconds(30);
+// windows covering more than this much of the screen are moved as an outline
+constexpr auto OUTLINE_MOVE_MIN_AREA_PERCENT = 50;
+// or if moving them for real falls this far behind the pointer
+constexpr auto OUTLINE_MOVE_LAG = std::chrono::milliseconds(100);
+// how long to wait for a client to answer a _NET_WM_SYNC_REQUEST, and how many times it can not answer before we stop asking
+constexpr auto SYNC_REQUEST_TIMEOUT = std::chrono::milliseconds(200);
+constexpr auto SYNC_REQUEST_MAX_TIMEOUTS = 3;
+// the most events handled, or the longest spent handling them, before what they asked for goes out
+constexpr std::uint64_t MAX_BATCH_EVENTS = 256;
+constexpr auto MAX_BATCH_TIME = std::chrono::milliseconds(16);
 // max time between clicks in double click
 constexpr auto DEF_DBLCLKTIME = 400;
 
@@ -91,16 +137,92 @@ constexpr auto getBorderWidth() noexcept {
     return DEF_BORDERWIDTH;
 }
 
-int getBarHeight() noexcept;
+/**
+ * Everything about the size of the decorations is derived from the
+ * ascent and descent of the font. Rather than asking xftfont every
+ * time, we work it all out once whenever the font changes and the rest
+ * of the code just reads the cached values. The derivations themselves
+ * are constexpr so the compiler can fold them wherever the inputs are
+ * known up front.
+ */
+class LayoutMetrics final {
+    public:
+        static constexpr int computeBarHeight(int ascent, int descent) noexcept {
+            return ascent + descent + 2 * SPACE + 2;
+        }
+        // the title bar buttons are square, and as tall as the inside of the bar
+        static constexpr int computeButtonWidth(int barHeight) noexcept {
+            return barHeight - DEF_BORDERWIDTH;
+        }
+        // offset of the top left corner of a glyph of the given size so that it sits centred in a button
+        template<int glyphSize>
+        static constexpr int computeGlyphOffset(int barHeight) noexcept {
+            return (barHeight / 2) - ((glyphSize + 1) / 2);
+        }
+        // minimum window width and height, enough for 3 buttons and a bit of titlebar
+        static constexpr int computeMinWinSize(int barHeight) noexcept {
+            return barHeight * 4;
+        }
+        static constexpr int computeTextBaseline(int ascent) noexcept {
+            return SPACE + ascent;
+        }
+    public:
+        static LayoutMetrics& current() noexcept { return _current; }
+        constexpr LayoutMetrics() noexcept = default;
+        constexpr LayoutMetrics(int ascent, int descent) noexcept :
+            _barHeight(computeBarHeight(ascent, descent)),
+            _buttonWidth(computeButtonWidth(_barHeight)),
+            _hideGlyphOffset(computeGlyphOffset<9>(_barHeight)),
+            _depthGlyphOffset(computeGlyphOffset<11>(_barHeight)),
+            _closeGlyphOffset(computeGlyphOffset<9>(_barHeight)),
+            _minWinWidth(computeMinWinSize(_barHeight)),
+            _minWinHeight(computeMinWinSize(_barHeight)),
+            _textBaseline(computeTextBaseline(ascent)) { }
+        /**
+         * Recompute everything from the given font; call this whenever the font changes.
+         */
+        void update(XftFont* font) noexcept { *this = LayoutMetrics(font->ascent, font->descent); }
+        constexpr auto getBarHeight() const noexcept { return _barHeight; }
+        constexpr auto getButtonWidth() const noexcept { return _buttonWidth; }
+        constexpr auto getHideGlyphOffset() const noexcept { return _hideGlyphOffset; }
+        constexpr auto getDepthGlyphOffset() const noexcept { return _depthGlyphOffset; }
+        constexpr auto getCloseGlyphOffset() const noexcept { return _closeGlyphOffset; }
+        constexpr auto getMinWinWidth() const noexcept { return _minWinWidth; }
+        constexpr auto getMinWinHeight() const noexcept { return _minWinHeight; }
+        constexpr auto getTextBaseline() const noexcept { return _textBaseline; }
+    private:
+        static LayoutMetrics _current;
+        int _barHeight = 0;
+        int _buttonWidth = 0;
+        int _hideGlyphOffset = 0;
+        int _depthGlyphOffset = 0;
+        int _closeGlyphOffset = 0;
+        int _minWinWidth = 0;
+        int _minWinHeight = 0;
+        int _textBaseline = 0;
+};
+
 // bar height
+inline auto getBarHeight() noexcept {
+    return LayoutMetrics::current().getBarHeight();
+}
+
+// width of each of the three title bar buttons, which is also the height of the inside of the bar
+inline auto getTitleButtonWidth() noexcept {
+    return LayoutMetrics::current().getButtonWidth();
+}
 
-// minimum window width and height, enough for 3 buttons and a bit of titlebar
 inline auto getMinWinWidth() noexcept {
-    return getBarHeight() * 4;
+    return LayoutMetrics::current().getMinWinWidth();
 }
 
 inline auto getMinWinHeight() noexcept {
-    return getBarHeight() * 4;
+    return LayoutMetrics::current().getMinWinHeight();
+}
+
+// y co-ordinate to draw text at so that it sits inside the bar
+inline auto getTextBaseline() noexcept {
+    return LayoutMetrics::current().getTextBaseline();
 }
 
 // multipliers for calling gravitate
@@ -124,6 +246,151 @@ constexpr auto REMAP = 1;
 #define NO_MENU_LABEL "xterm"
 #define NO_MENU_COMMAND "xterm"
 class Rect;
+
+/**
+ * Every distinct title and class is only kept once, however many
+ * clients (and laid out titles) use it. A desktop full of terminals
+ * or browser windows has lots of those. Strings are refcounted by
+ * InternedString and dropped when the last one goes.
+ */
+class StringArena final {
+    public:
+        static StringArena& instance() noexcept;
+        /**
+         * @return the id of text, with its refcount bumped; never 0
+         */
+        std::uint32_t intern(std::string_view text);
+        void retain(std::uint32_t id) noexcept;
+        void release(std::uint32_t id) noexcept;
+        const std::string& get(std::uint32_t id) const noexcept { return _entries[id].text; }
+        /**
+         * How many distinct strings are in use, and roughly how many bytes they take up.
+         */
+        std::tuple<std::size_t, std::size_t> usage() const noexcept;
+    private:
+        StringArena();
+        struct Entry {
+            std::string text;
+            std::uint32_t refs = 0;
+        };
+        // a deque so the entries (which _index points into) never move; 0 is the empty string
+        std::deque<Entry> _entries;
+        std::vector<std::uint32_t> _free;
+        std::unordered_map<std::string_view, std::uint32_t> _index;
+};
+
+/**
+ * A handle on a string in the StringArena, or on no string at all.
+ * Reads like a std::optional<std::string> but only takes 4 bytes.
+ */
+class InternedString final {
+    public:
+        InternedString() noexcept = default;
+        InternedString(const std::string& text) : _id(StringArena::instance().intern(text)) { }
+        InternedString(const std::optional<std::string>& text) : _id(text ? StringArena::instance().intern(*text) : 0) { }
+        InternedString(const InternedString& other) noexcept : _id(other._id) { StringArena::instance().retain(_id); }
+        InternedString(InternedString&& other) noexcept : _id(std::exchange(other._id, 0)) { }
+        InternedString& operator=(InternedString other) noexcept {
+            std::swap(_id, other._id);
+            return *this;
+        }
+        ~InternedString() { StringArena::instance().release(_id); }
+        explicit operator bool() const noexcept { return _id != 0; }
+        // the empty string if there's no string
+        const std::string& operator*() const noexcept { return StringArena::instance().get(_id); }
+        const std::string* operator->() const noexcept { return &**this; }
+        std::string value_or(const std::string& fallback) const { return _id ? **this : fallback; }
+        bool operator==(const InternedString& other) const noexcept { return _id == other._id; }
+        bool operator==(const std::optional<std::string>& other) const noexcept { return other ? (_id && **this == *other) : !_id; }
+    private:
+        std::uint32_t _id = 0;
+};
+
+/**
+ * A string of UTF-8 text laid out as glyphs, ready to be blitted with
+ * XftDrawGlyphFontSpec. Characters the font doesn't have are taken from
+ * a fallback font found through fontconfig, and text which is too wide
+ * is cut short with an ellipsis.
+ */
+class GlyphRun final {
+    public:
+        /**
+         * @param font the font to use wherever it has the glyph
+         * @param text UTF-8 text
+         * @param maxWidth the widest the run may be, in pixels
+         */
+        static GlyphRun layout(XftFont* font, const std::string& text, int maxWidth = std::numeric_limits<int>::max());
+        void draw(XftDraw* d, XftColor* color, int x, int y) noexcept;
+        int getWidth() const noexcept { return _width; }
+        bool empty() const noexcept { return _glyphs.empty(); }
+        /**
+         * Would this draw exactly the same glyphs as other?
+         */
+        bool sameGlyphs(const GlyphRun& other) const noexcept;
+        std::size_t memoryUsage() const noexcept { return _glyphs.capacity() * sizeof(XftGlyphFontSpec); }
+    private:
+        std::vector<XftGlyphFontSpec> _glyphs;
+        int _width = 0;
+        // where the glyphs are currently positioned for
+        int _x = 0;
+        int _y = 0;
+};
+
+/**
+ * Holds on to the layout of one piece of text, so that redrawing it
+ * with the same text, font and width doesn't lay it out again.
+ */
+class CachedGlyphRun final {
+    public:
+        GlyphRun& get(XftFont* font, const std::string& text, int maxWidth);
+        /**
+         * Lay out new text with the font and width we were last asked for.
+         * @return true if that changes what would be drawn (or we've never been drawn, so can't tell)
+         */
+        bool update(const std::string& text);
+        void invalidate() noexcept { _font = nullptr; }
+        /**
+         * Roughly how much heap the layout is holding on to (the text is in the StringArena).
+         */
+        std::size_t memoryUsage() const noexcept { return _run.memoryUsage(); }
+    private:
+        XftFont* _font = nullptr;
+        // usually the same string as the client's title, so it costs nothing extra
+        InternedString _text;
+        int _maxWidth = 0;
+        GlyphRun _run;
+};
+/**
+ * The parts of WM_NORMAL_HINTS we use, with the same names as in
+ * XSizeHints. flags is 0 if the client hasn't set any.
+ */
+struct ClientSizeHints {
+    ClientSizeHints() noexcept = default;
+    explicit ClientSizeHints(const XSizeHints& hints) noexcept;
+    std::uint32_t flags = 0;
+    int min_width = 0;
+    int min_height = 0;
+    int max_width = 0;
+    int max_height = 0;
+    int width_inc = 0;
+    int height_inc = 0;
+    int base_width = 0;
+    int base_height = 0;
+    int win_gravity = 0;
+};
+
+/**
+ * The parts of WM_HINTS we use, with the same names as in XWMHints.
+ */
+struct ClientWMHints {
+    ClientWMHints() noexcept = default;
+    explicit ClientWMHints(const XWMHints& hints) noexcept;
+    Window window_group = None;
+    std::uint32_t flags = 0;
+    int initial_state = 0;
+    bool input = false;
+};
+
 /* This structure keeps track of top-level windows (hereinafter
  * 'clients'). The clients we know about (i.e. all that don't set
  * override-redirect) are kept track of in linked list starting at the
@@ -145,8 +412,13 @@ struct Client {
         using Ptr = std::shared_ptr<Client>;
         using WeakPtr = std::weak_ptr<Client>;
         static void makeNew(Window) noexcept;
+        /**
+         * Manage a batch of windows at once.
+         * @param onlyViewable skip windows that aren't mapped (when taking over from another window manager)
+         */
+        static void makeNew(const std::vector<Window>& windows, bool onlyViewable = false) noexcept;
     public:
-        long getWMState() const noexcept;
+        long getWMState() noexcept;
         void setWMState(int) noexcept; 
         /**
          * Return which button was clicked - this is a multiple of getBarHeight()
@@ -160,8 +432,27 @@ struct Client {
         void lowerWindow() noexcept;
         void raiseWindow() noexcept;
         void sendConfig() noexcept;
+        /**
+         * Put the frame and the client window where the client's position
+         * and size say, and tell the client.
+         */
+        void applyGeometry() noexcept;
         void reparent() noexcept;
+        /**
+         * Give the frame back to the pool, along with everything else that
+         * only matters while the client is on screen. unhide() makes a new one.
+         */
+        void releaseFrame() noexcept;
+        /**
+         * Shape the frame to match the client, from what we know of the
+         * client's shape (as of makeNew, then shapeChanged).
+         */
         void setShape() noexcept;
+        void shapeChanged(const XShapeEvent& e) noexcept;
+        /**
+         * Bring the frame's shape up to date after we've resized the client.
+         */
+        void resizeShape() noexcept;
         void redraw() noexcept;
         void rememberHidden() noexcept;
         void forgetHidden() noexcept;
@@ -177,19 +468,69 @@ struct Client {
         auto getTrans() const noexcept { return _trans; }
         void setFrame(Window frame) noexcept { _frame = frame; }
         void setTrans(Window trans) noexcept { _trans = trans; }
-        const std::optional<std::string>& getName() const noexcept { return _name; }
-        void setName(const std::string& name) noexcept { _name.emplace(name); }
+        const InternedString& getName() const noexcept { return _name; }
+        void setName(const std::string& name) noexcept { _name = name; }
         void setName(const std::optional<std::string>& name) noexcept { _name = name; }
+        const InternedString& getClass() const noexcept { return _class; }
+        void setClass(const std::optional<std::string>& value) noexcept { _class = value; }
+        /**
+         * The laid out title for the frame and the taskbar respectively.
+         */
+        CachedGlyphRun& getFrameTitle() noexcept { return _frameTitle; }
+        CachedGlyphRun& getTaskbarTitle() noexcept { return _taskbarTitle; }
+        constexpr bool isTitleDirty() const noexcept { return _titleDirty; }
+        void setTitleDirty(bool value) noexcept { _titleDirty = value; }
+        auto getGroup() const noexcept { return _group; }
+        void setGroup(Window value) noexcept { _group = value; }
+        /**
+         * Read the window group out of the client's WM_HINTS.
+         */
+        void updateGroup() noexcept;
         constexpr auto getFocusOrder() const noexcept { return _focus_order; }
         void setFocusOrder(unsigned int value) noexcept { _focus_order = value; }
         void incrementFocusOrder() noexcept { ++_focus_order; }
-        XSizeHints* getSize() const noexcept { return _size; }
-        void setSize(XSizeHints* value) noexcept { _size = value; }
+        /**
+         * WM_NORMAL_HINTS, refetched only if they've changed since we last looked.
+         */
+        ClientSizeHints* getSize() noexcept;
+        /**
+         * Does the client list protocol (WM_DELETE_WINDOW, WM_TAKE_FOCUS or _NET_WM_SYNC_REQUEST) in its WM_PROTOCOLS?
+         */
+        bool supportsProtocol(Atom protocol) noexcept;
+        /**
+         * The client's WM_HINTS, or nullptr if it hasn't set any.
+         */
+        const ClientWMHints* getWMHints() noexcept;
+        /**
+         * Should we set the input focus on the client, going by the input
+         * field of its WM_HINTS? Clients that say no can still take it
+         * themselves if they support WM_TAKE_FOCUS.
+         */
+        bool acceptsInput() noexcept;
+        /**
+         * Set up the passive grab for click-to-focus on the frame, unless
+         * that's already been done.
+         */
+        void grabButtons() noexcept;
+        /**
+         * Forget whatever we have cached for property so that it is read again next time it is wanted.
+         */
+        void propertyChanged(Atom property) noexcept;
         auto getColormap() const noexcept { return _cmap; }
         void setColormap(Colormap value) noexcept { _cmap = value; } 
-        auto getXftDraw() const noexcept { return _xftdraw; }
-        void setXftDraw(XftDraw* value) noexcept { _xftdraw = value; }
+        /**
+         * The Xft context for drawing on the frame, made the first time it's needed.
+         */
+        XftDraw* getXftDraw() noexcept;
+        bool hasXftDraw() const noexcept { return _xftdraw != nullptr; }
         constexpr auto isHidden() const noexcept { return _hidden; }
+        constexpr auto getHiddenSince() const noexcept { return _hiddenSince; }
+        /**
+         * Has ClientTracker::remove been called on this client? If so, it's
+         * waiting for the end of the batch to be torn down.
+         */
+        constexpr auto isBeingRemoved() const noexcept { return _removing; }
+        void setBeingRemoved() noexcept { _removing = true; }
         void setHidden(bool value) noexcept { _hidden = value; }
         constexpr auto wasHidden() const noexcept { return _wasHidden; }
         void setWasHidden(bool value) noexcept { _wasHidden = value; }
@@ -211,34 +552,83 @@ struct Client {
         void fixPosition() noexcept;
         void refixPosition(XConfigureRequestEvent*);
         void dump() const noexcept;
+        /**
+         * Roughly how many bytes we're using to keep track of the client,
+         * not counting the X server's side of things.
+         */
+        std::size_t memoryUsage() const noexcept;
         void sendWMDelete() noexcept;
         void removeFromView() noexcept;
         ~Client();
     private:
         void setDimensions(XWindowAttributes& attr) noexcept;
-        Client(Window w) noexcept : _window(w) { };
-        void initPosition() noexcept;
+        Client(Window w) noexcept : _window(w), _hidden(false), _wasHidden(false), _removing(false), _titleDirty(false), _buttonsGrabbed(false),
+                                    _shaped(false), _hasBeenShaped(false), _wmHintsFetched(false), _sizeStale(false), _protocolsFetched(false),
+                                    _moveOutline(false) { };
+        void setProtocols(const std::vector<Atom>& protocols) noexcept;
+        /**
+         * @param mousePosition where to put the window if it hasn't said; only called if needed
+         */
+        void initPosition(const std::function<std::tuple<int, int>()>& mousePosition) noexcept;
+        /**
+         * Get a frame from the pool and put the client in it.
+         */
+        void attachFrame() noexcept;
+        /**
+         * Give the frame back to the pool, after the client has been taken out of it.
+         */
+        void detachFrame() noexcept;
         void drawLine(GC gc, int x1, int y1, int x2, int y2) noexcept;
         void drawRectangle(GC gc, int x, int y, unsigned int width, unsigned int height) noexcept;
         void fillRectangle(GC gc, int x, int y, unsigned int width, unsigned int height) noexcept;
+        /**
+         * XOR the outline of the frame onto the root window as if the client were at x, y, so drawing it twice takes it away again.
+         */
+        void drawOutline(int x, int y) noexcept;
         inline void drawLine(GC* gc, int x1, int y1, int x2, int y2) noexcept { drawLine(*gc, x1, y1, x2, y2); }
     private:
+        // hot: looked at for nearly every event, so kept together at the front
         Window _window;
-        Window _frame;
-        Window _trans;
-        std::optional<std::string> _name;
-	    unsigned int _focus_order = 0u;
-        Bool _hasBeenShaped = 0;
-        XSizeHints* _size = nullptr;
-        Colormap _cmap = 0;
-        XftDraw* _xftdraw = nullptr;
-        bool _hidden = false;
-        bool _wasHidden = false;
-        int _ignoreUnmap = 0;
+        // None while the client is hidden and its frame has been reclaimed
+        Window _frame = None;
+        Window _trans = None;
+        Window _group = None;
         int _x = 0;
         int _y = 0;
         int _width = 0;
         int _height = 0;
+	    unsigned int _focus_order = 0u;
+        int _ignoreUnmap = 0;
+        // how wide the client was when we last shaped the frame
+        int _shapedWidth = 0;
+        bool _hidden : 1;
+        bool _wasHidden : 1;
+        bool _removing : 1;
+        bool _titleDirty : 1;
+        bool _buttonsGrabbed : 1;
+        // whether the client has a bounding shape (as of the last ShapeNotify), and whether we've shaped the frame
+        bool _shaped : 1;
+        bool _hasBeenShaped : 1;
+        // properties read from the client, kept until a PropertyNotify says they've changed
+        bool _wmHintsFetched : 1;
+        bool _sizeStale : 1;
+        bool _protocolsFetched : 1;
+        // moving it for real has fallen behind before, so it's moved as an outline from now on
+        bool _moveOutline : 1;
+        // a bit for each of the protocols supportsProtocol() knows about
+        std::uint8_t _protocols = 0;
+        // -1 until we know
+        std::int8_t _wmState = -1;
+        Colormap _cmap = 0;
+        XftDraw* _xftdraw = nullptr;
+        // cold: only wanted when drawing, (un)hiding or the client changes something
+        InternedString _name;
+        InternedString _class;
+        std::chrono::steady_clock::time_point _hiddenSince;
+        ClientWMHints _wmHints;
+        ClientSizeHints _size;
+        CachedGlyphRun _frameTitle;
+        CachedGlyphRun _taskbarTitle;
         WeakPtr _selfReference;
 };
 
@@ -365,6 +755,12 @@ class DisplayManager final {
         }
 
         void grabKeysym(Window w, unsigned int mask, KeySym keysym) noexcept;
+        bool grabKeyboard(Window w) noexcept {
+            return XGrabKeyboard(_display, w, False, GrabModeAsync, GrabModeAsync, CurrentTime) == GrabSuccess;
+        }
+        void ungrabKeyboard() noexcept {
+            XUngrabKeyboard(_display, CurrentTime);
+        }
         inline auto changeProperty(Window w, Atom property, Atom type, int format, int mode, unsigned char* data, int nelements) noexcept {
             return XChangeProperty(_display, w, property, type, format, mode, data, nelements);
         }
@@ -407,9 +803,23 @@ class DisplayManager final {
             return XMapRaised(_display, w);
         }
 
+        /**
+         * A full round trip; keep it off the normal paths (see doEventLoop).
+         */
         auto sync(Bool discard) noexcept {
             return XSync(_display, discard);
         }
+        auto flush() noexcept {
+            return XFlush(_display);
+        }
+        /**
+         * Number of events waiting, reading whatever has already arrived if
+         * the queue is empty but, unlike pending(), only flushing if mode
+         * is QueuedAfterFlush.
+         */
+        auto eventsQueued(int mode = QueuedAfterReading) noexcept {
+            return XEventsQueued(_display, mode);
+        }
 
         auto moveResizeWindow(Window w, int x, int y, unsigned int width, unsigned int height) noexcept {
             return XMoveResizeWindow(_display, w, x, y, width, height);
@@ -436,6 +846,25 @@ class DisplayManager final {
         auto internAtom(const std::string& str, Bool onlyIfExists) noexcept {
             return XInternAtom(_display, str.c_str(), onlyIfExists);
         }
+        /**
+         * Intern a whole set of atoms with a single round trip.
+         * @param names the atom names, in the order the results should come back
+         * @param onlyIfExists passed straight through to XInternAtoms
+         * @return the atoms, in the same order as names
+         */
+        std::vector<Atom> internAtoms(const std::vector<std::string>& names, Bool onlyIfExists = False) noexcept;
+        /**
+         * Work out the pixel value (and rgb values) for a colour spec. #rgb
+         * style specs are parsed locally and on TrueColor visuals the pixel
+         * is computed from the visual's masks, so the common case doesn't
+         * talk to the server at all.
+         * @return false if the colour couldn't be found
+         */
+        bool resolveColor(const std::string& spec, XColor& screenDefReturn) noexcept;
+        /**
+         * Fill in the pixel value for the rgb values already in the given colour.
+         */
+        bool resolvePixel(XColor& screenInOut) noexcept;
 
         auto allocColor(Colormap cm, XColor& screenInOut) noexcept {
             return XAllocColor(_display, cm, &screenInOut);
@@ -519,6 +948,15 @@ class DisplayManager final {
 
         constexpr auto getNumLockMask() const noexcept { return _numLockMask; }
         void setNumLockMask(unsigned int value) noexcept { _numLockMask = value; }
+        void addModifierKeycode(KeyCode keycode) { _modifierKeycodes.emplace_back(keycode); }
+        /**
+         * Is this one of the keys which make up MODIFIER?
+         */
+        bool isModifierKeycode(KeyCode keycode) const noexcept { return std::find(_modifierKeycodes.begin(), _modifierKeycodes.end(), keycode) != _modifierKeycodes.end(); }
+        /**
+         * The modifier keys (and buttons) held down right now.
+         */
+        unsigned int queryModifierState() noexcept;
         std::tuple<int, int> getMousePosition() noexcept;
 
         auto resizeWindow(Window w, unsigned int width, unsigned int height) noexcept {
@@ -628,8 +1066,14 @@ class DisplayManager final {
         Window _root = 0;
         int _screen = 0;
         unsigned int _numLockMask = 0;
+        std::vector<KeyCode> _modifierKeycodes;
 };
 using ClientPointer = typename Client::Ptr;
+/**
+ * The server time of the latest event we've had that carries one, for
+ * the requests the ICCCM says shouldn't be made with CurrentTime.
+ */
+Time getLastEventTime() noexcept;
 class ClientTracker final {
     public:
         static ClientTracker& instance() noexcept {
@@ -660,10 +1104,51 @@ class ClientTracker final {
          * @return boolean value to signify if execution should terminate early (return true for it)
          */
         bool accept(std::function<bool(ClientPointer)> fn);
+        /**
+         * Stop managing a client. The client leaves the client list at once
+         * but is only torn down by flushRemovals(), so that a burst of
+         * windows going away costs one server grab and one repaint.
+         */
         void remove(ClientPointer, int);
+        /**
+         * Tear down everything remove() has queued up. Called at the end of
+         * every dispatch batch.
+         */
+        void flushRemovals();
         inline void withdraw(ClientPointer c) { remove(c, WITHDRAW); }
         inline void remap(ClientPointer c) { remove(c, REMAP); }
-        void checkFocus(ClientPointer c);
+        /**
+         * Make c the focused client, giving it the input focus in whichever
+         * of the ICCCM's ways it asks for.
+         * @param time the server time of the event that led to this
+         */
+        void checkFocus(ClientPointer c, Time time);
+        /**
+         * As above, for the latest event we've had.
+         */
+        void checkFocus(ClientPointer c) { checkFocus(c, getLastEventTime()); }
+        /**
+         * Set the input focus to w, remembering that we did so.
+         */
+        void setInputFocus(Window w, Time time) noexcept;
+        /**
+         * Install cmap unless it was the last one we installed.
+         */
+        void installColormap(Colormap cmap) noexcept;
+        /**
+         * Keep track of where the focus and the installed colormap really
+         * are, since clients can move both without asking us.
+         */
+        void focusChanged(const XFocusChangeEvent& e) noexcept;
+        void colormapChanged(const XColormapEvent& e) noexcept;
+        /**
+         * Bring c to the front (unhiding it if need be) and give it the focus.
+         */
+        void switchTo(ClientPointer c);
+        /**
+         * The clients, most recently focused first.
+         */
+        std::vector<ClientPointer> byRecentFocus() const;
         auto getFocusedClient() const noexcept { return _focusedClient; }
         void setFocusedClient(ClientPointer p) noexcept { _focusedClient = p; }
         bool hasFocusedClient() const noexcept { return static_cast<bool>(_focusedClient); }
@@ -689,6 +1174,25 @@ class ClientTracker final {
             _fullscreenPreviousDimensions = other;
         }
         void toggleFullscreen() noexcept;
+        /**
+         * Switch to new decoration metrics (i.e. the font has changed) and
+         * move every frame and client window to match.
+         */
+        void changeMetrics(const LayoutMetrics& metrics) noexcept;
+        /**
+         * Make sure reclaimHidden() will get called for a client that has
+         * just been hidden, unless -reclaim 0 turned that off.
+         */
+        void scheduleReclaim() noexcept;
+        /**
+         * Release the frames of clients that have been hidden for longer
+         * than -reclaim says.
+         */
+        void reclaimHidden() noexcept;
+        /**
+         * Write how much memory the clients are taking up to stderr (on SIGUSR1).
+         */
+        void reportMemoryUsage() const noexcept;
 
     public:
         ClientTracker(const ClientTracker&) = delete;
@@ -710,6 +1214,13 @@ class ClientTracker final {
         ClientPointer _fullscreenClient;
         Rect _fullscreenPreviousDimensions;
         unsigned int _focusCount = 0;
+        // None when we don't know
+        Window _inputFocus = None;
+        Colormap _installedColormap = None;
+        std::vector<std::tuple<ClientPointer, int>> _removals;
+        // one of them had the focus, so it needs to go somewhere else
+        bool _focusRemoved = false;
+        bool _reclaimScheduled = false;
 
 };
 class Taskbar final {
@@ -724,9 +1235,112 @@ class Taskbar final {
         void redraw();
         float getButtonWidth();
         Window& getWindow() noexcept { return _taskbar; }
+        /**
+         * Resize the taskbar to fit the current bar height.
+         */
+        void resize() noexcept;
+        /**
+         * What the user chose from a prompt.
+         */
+        struct PromptResult {
+            // index into the labels from the last search, if there were any to choose from
+            std::optional<std::size_t> selected;
+            std::string query;
+        };
+        using PromptSearch = std::function<std::vector<std::string>(const std::string&)>;
+        using PromptDone = std::function<void(std::optional<PromptResult>)>;
+        /**
+         * Take over the taskbar to read a line from the keyboard, offering
+         * the results of search for whatever has been typed so far. Tab and
+         * the arrow keys move between the results, Return accepts and
+         * Escape cancels. The keys come through the event loop like
+         * everything else, so nothing waits on the prompt.
+         * @param label shown in front of the query
+         * @param search called every time the query changes
+         * @param done called once the prompt is over, with nothing if it was cancelled
+         */
+        void prompt(const std::string& label, PromptSearch search, PromptDone done);
+        /**
+         * Run the open prompt's search again, for when what it searches has changed.
+         */
+        void refreshPrompt();
+        /**
+         * Prompt for a command from $PATH and run it.
+         */
+        void launcher();
+        /**
+         * Prompt for a window by title or class and switch to it.
+         */
+        void switcher();
+        /**
+         * Alt+Tab in most recently used order. While MODIFIER is held the
+         * candidate is only highlighted in the taskbar; nothing is raised
+         * or focused until it is let go.
+         * @param forward true to start with the previously focused client, false for the least recently focused
+         */
+        void cycleRecent(bool forward);
+        /**
+         * While a prompt or an MRU cycle has the keyboard grabbed, the
+         * event loop hands it the keys.
+         * @return false if neither is going on, so the key is the event loop's to handle
+         */
+        bool keyPress(XKeyEvent& e);
+        bool keyRelease(const XKeyEvent& e);
+        /**
+         * Give up on the prompt or MRU cycle (if there is one), as if Escape had been pressed.
+         */
+        void cancelKeyboardGrab();
+        /**
+         * Are there too many clients for a button each, so that they are grouped?
+         */
+        bool grouping() noexcept;
+        /**
+         * Repaint the buttons for the clients that lost and gained the
+         * focus, rather than the whole taskbar.
+         */
+        void focusChanged(ClientPointer previous, ClientPointer current);
     private:
         Taskbar() = default;
     private:
+        void drawButton(unsigned int index, ClientPointer c, float buttonWidth);
+        void redrawButtons(ClientPointer first, ClientPointer second);
+        void highlight(ClientPointer c);
+        /**
+         * When there are too many clients for a button each, the taskbar
+         * shows a button for each WM_CLASS (or window group) instead, and
+         * only as many of those as fit, with arrows to scroll the rest
+         * into view.
+         */
+        struct Group {
+            std::string key;
+            std::vector<ClientPointer> members;
+        };
+        struct GroupLayout {
+            // how wide each of the scroll arrows is, 0 if everything fits
+            int arrowWidth = 0;
+            std::size_t first = 0;
+            std::size_t count = 0;
+            float width = 0;
+        };
+        enum class ButtonKind {
+            Nothing,
+            ScrollBack,
+            ScrollForward,
+            Group,
+        };
+        std::vector<Group> buildGroups() const;
+        GroupLayout layoutGroups(std::size_t groupCount) noexcept;
+        /**
+         * What is at x on the taskbar when grouping.
+         * @return the kind of thing there and, for a group, its index
+         */
+        std::tuple<ButtonKind, std::size_t> buttonAt(int x, std::size_t groupCount) noexcept;
+        void redrawGroups();
+        void clickGroup(const Group& group);
+        void drawPrompt();
+        void finishPrompt(std::optional<PromptResult> result);
+        void stepCycle(bool forward);
+        void finishCycle(bool commit);
         void drawMenubar();
         unsigned int updateMenuItem(int mousex);
         void drawMenuItem(unsigned int index, bool active);
@@ -743,19 +1357,74 @@ class Taskbar final {
         XftDraw* _tbxftdraw = nullptr;
         bool _showing = true;
         bool _inside = false;
+        ClientPointer _highlighted;
+        std::size_t _firstGroup = 0;
+        struct Prompt {
+            std::string label;
+            PromptSearch search;
+            PromptDone done;
+            std::string query;
+            std::vector<std::string> results;
+            std::size_t selected = 0;
+        };
+        std::optional<Prompt> _prompt;
+        struct Cycle {
+            // most recently focused first, as of when it started
+            std::vector<ClientPointer> clients;
+            std::size_t current = 0;
+        };
+        std::optional<Cycle> _cycle;
 };
 
 extern XFontStruct *font;
 extern XftFont *xftfont;
 extern XftColor xft_detail;
-extern GC border_gc, text_gc, active_gc, depressed_gc, inactive_gc, menu_gc, selected_gc, empty_gc;
+extern GC outline_gc, border_gc, text_gc, active_gc, depressed_gc, inactive_gc, menu_gc, selected_gc, empty_gc;
 extern XColor border_col, text_col, active_col, depressed_col, inactive_col, menu_col, selected_col, empty_col;
 extern Cursor resize_curs;
-extern Atom wm_state, wm_change_state, wm_protos, wm_delete, wm_cmapwins;
+extern Atom wm_state, wm_change_state, wm_protos, wm_delete, wm_cmapwins, wm_take_focus;
+extern Atom net_wm_pid, net_startup_id, utf8_string, wl_launch_stats, net_wm_name, net_wm_sync_request, net_wm_sync_request_counter;
 extern int shape, shape_event;
+extern bool opt_progressive;
+extern bool opt_mru;
+extern bool opt_outline;
+extern int opt_reclaim;
+extern std::string opt_font;
 
 // events.c
 void doEventLoop();
+/**
+ * Have the event loop wait on another file descriptor as well as the X connection.
+ * @param fd the descriptor to watch for readability
+ * @param onReadable called from the event loop whenever fd is readable
+ */
+void addEventSource(int fd, std::function<void()> onReadable);
+void removeEventSource(int fd);
+/**
+ * Have the event loop call fn once, after delay.
+ * @return an id for cancelTimer()
+ */
+std::uint64_t addTimer(std::chrono::milliseconds delay, std::function<void()> fn);
+void cancelTimer(std::uint64_t id);
+
+/**
+ * Title changes are picked up at most once a frame. A PropertyNotify
+ * only marks the client; when the frame is up we fetch each marked
+ * client's title once, however many times it changed in between, and
+ * only repaint what actually looks different.
+ */
+class TitleUpdater final {
+    public:
+        static TitleUpdater& instance() noexcept;
+        void markDirty(ClientPointer c);
+    private:
+        TitleUpdater() = default;
+        void flush();
+    private:
+        std::vector<Client::WeakPtr> _dirty;
+        bool _scheduled = false;
+        std::chrono::steady_clock::time_point _lastFlush;
+};
 
 // misc.c
 template<typename ... Args>
@@ -776,15 +1445,553 @@ std::string getEnvironmentVariable(const std::string& name, const std::string& d
 
 void signalHandler(int);
 int handleXError(Display *, XErrorEvent *);
-int sendXMessage(Window, Atom, long);
+/**
+ * Errors come back long after the request that caused them, so rather
+ * than XSync'ing to find out, we note the sequence numbers of the
+ * requests made on behalf of each client and look the error's serial up
+ * when it arrives.
+ */
+class ErrorTracker final {
+    public:
+        static ErrorTracker& instance() noexcept;
+        /**
+         * The requests made while this is alive are on behalf of window's
+         * client. When tearing a client down, errors are expected (the
+         * window may well be gone already) and simply dropped.
+         */
+        class Scope final {
+            public:
+                explicit Scope(Window window, bool teardown = false) noexcept;
+                ~Scope();
+                Scope(const Scope&) = delete;
+                Scope& operator=(const Scope&) = delete;
+            private:
+                Window _window;
+                bool _teardown;
+                unsigned long _first;
+        };
+        /**
+         * window has been destroyed, so errors about it from the requests
+         * already sent are to be expected.
+         */
+        void windowGone(Window window) noexcept;
+        /**
+         * @return true if the error is one we expected and can ignore
+         */
+        bool expected(const XErrorEvent& e) const noexcept;
+        /**
+         * The client window the request behind e was made for, or the
+         * window it was about if we don't know.
+         */
+        Window blame(const XErrorEvent& e) const noexcept;
+        /**
+         * Withdraw window's client once we're out of the error handler
+         * (which mustn't make requests of its own).
+         */
+        void clientFailed(Window window) noexcept { _failed.emplace_back(window); }
+        void withdrawFailedClients();
+        /**
+         * Forget about requests the server has dealt with, since any
+         * errors from those have already been handled.
+         */
+        void prune() noexcept;
+    private:
+        ErrorTracker() = default;
+        struct Range {
+            unsigned long first;
+            unsigned long last;
+            Window window;
+            bool teardown;
+        };
+        // in the order the scopes ended, so an inner scope comes before the one around it
+        std::deque<Range> _ranges;
+        // destroyed windows and the first request made after we found out
+        std::map<Window, unsigned long> _gone;
+        std::vector<Window> _failed;
+};
+int sendXMessage(Window, Atom, long, Time);
 void showEvent(XEvent);
 void dumpClients();
 
+/**
+ * Which of the cached client properties a lookup was for.
+ */
+enum class CachedProperty {
+    WMState,
+    Protocols,
+    Hints,
+    NormalHints,
+    Count,
+};
+/**
+ * Count a lookup in a client's property cache.
+ * @param hit true if it was answered from the cache
+ */
+void countPropertyLookup(CachedProperty property, bool hit) noexcept;
+/**
+ * Record one dispatch batch: the events handled between two waits for input.
+ * @param events how many events were handled
+ * @param requests how many Xlib calls that send requests were made
+ * @param roundTrips how many of them had to wait for the server
+ */
+void countBatch(std::uint64_t events, std::uint64_t requests, std::uint64_t roundTrips) noexcept;
+/**
+ * Ask for the statistics to be written to stderr the next time round the event loop (safe to call from a signal handler).
+ */
+void requestStatisticsReport() noexcept;
+bool statisticsReportRequested() noexcept;
+void reportStatistics() noexcept;
+/**
+ * Keep a line about how long startup took for the statistics report
+ * (and, in debug builds, write it to stderr straight away).
+ */
+void recordStartupLine(const std::string& line) noexcept;
+template<typename ... Args>
+void recordStartupTiming(Args&& ... parts) noexcept {
+    std::ostringstream line;
+    (line << ... << parts);
+    recordStartupLine(line.str());
+}
+
 void drawString(XftDraw* d, XftColor* color, XftFont* font, int x, int y, const std::string& string);
-std::tuple<Status, std::optional<std::string>> fetchName(Display* disp, Window w);
+int textWidth(XftFont* font, const std::string& string);
+/**
+ * Where we keep things that can be thrown away and rebuilt ($XDG_CACHE_HOME/windowlab).
+ */
+const std::filesystem::path& getCacheDirectory() noexcept;
+// helpers for reading and writing the binary cache files
+template<typename T>
+void writeCacheValue(std::ostream& out, T value) noexcept {
+    out.write(reinterpret_cast<const char*>(&value), sizeof value);
+}
+template<typename T>
+bool readCacheValue(std::istream& in, T& value) noexcept {
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof value));
+}
+void writeCacheString(std::ostream& out, const std::string& str) noexcept;
+bool readCacheString(std::istream& in, std::string& str) noexcept;
+/**
+ * The window's title as UTF-8, from _NET_WM_NAME if it has one and otherwise WM_NAME.
+ */
+std::optional<std::string> fetchTitle(Display* disp, Window w);
+/**
+ * Turn a WM_NAME in whatever encoding the client chose into UTF-8.
+ */
+std::optional<std::string> decodeTitle(Display* disp, XTextProperty& prop);
+/**
+ * The class part of WM_CLASS (e.g. "Firefox"), if the window has one.
+ */
+std::optional<std::string> fetchClass(Display* disp, Window w);
+
+// pool.c
+enum class PooledWindow {
+    // a client's frame
+    Frame,
+    // InputOnly, for confining the pointer while it is grabbed
+    Constraint,
+    // what's shown instead of the frame while resizing, with a title bar window inside
+    ResizeOutline,
+    Count,
+};
+/**
+ * Windows we keep needing and throwing away (frames as terminals come and
+ * go, the helper windows for every drag) are handed back here instead of
+ * being destroyed, and handed out again reconfigured. Whatever has been
+ * idle for POOLED_WINDOW_IDLE_TIME is destroyed, down to the few that
+ * were made at startup.
+ */
+class WindowPool final {
+    public:
+        static WindowPool& instance() noexcept;
+        /**
+         * An unmapped window of the given kind, moved and sized to dims.
+         */
+        Window acquire(PooledWindow kind, const Rect& dims);
+        /**
+         * Take a window back (unmapping it); it must have no children of
+         * anyone else's left in it.
+         */
+        void release(PooledWindow kind, Window w);
+        /**
+         * The title bar window inside a ResizeOutline.
+         */
+        Window getResizeBar(Window outline) const;
+        /**
+         * Make the windows every session will want, so the first drag
+         * doesn't have to wait for them.
+         */
+        void prime();
+        WindowPool(const WindowPool&) = delete;
+        WindowPool& operator=(const WindowPool&) = delete;
+    private:
+        WindowPool() = default;
+        Window create(PooledWindow kind, const Rect& dims);
+        void destroy(PooledWindow kind, Window w);
+        void reclaim();
+        struct Idle {
+            Window window;
+            std::chrono::steady_clock::time_point since;
+        };
+    private:
+        std::array<std::vector<Idle>, static_cast<std::size_t>(PooledWindow::Count)> _idle;
+        std::map<Window, Window> _resizeBars;
+        bool _reclaimScheduled = false;
+};
+
+// sync.c
+/**
+ * Throttles configuring clients that support _NET_WM_SYNC_REQUEST to
+ * the rate they can redraw at.
+ */
+class ResizeSync final {
+    public:
+        static ResizeSync& instance() noexcept;
+        /**
+         * Look for the SYNC extension; without it everything is applied straight away.
+         */
+        void init();
+        /**
+         * Run apply (which configures c) now, or if c is still redrawing
+         * after the last one, once it has finished. Only the latest of
+         * the changes held back like that is run.
+         * @param resizing whether apply changes c's size, which is what the client has to redraw for
+         */
+        void configure(ClientPointer c, bool resizing, std::function<void()> apply);
+        /**
+         * @return true if e was one of our alarms (whether or not it meant anything)
+         */
+        bool handleEvent(const XEvent& e);
+        /**
+         * Stop syncing with w (it's gone, or it's changed its protocols or counter).
+         */
+        void forget(Window w);
+        void report() const noexcept;
+    public:
+        ResizeSync(const ResizeSync&) = delete;
+        ResizeSync(ResizeSync&&) = delete;
+    private:
+        ResizeSync() = default;
+        struct State {
+            Client::WeakPtr client;
+            // None if the client doesn't sync
+            XID counter = None;
+            XID alarm = None;
+            // the last value we asked for
+            std::uint64_t value = 0;
+            bool waiting = false;
+            // in a row
+            int timeouts = 0;
+            std::uint64_t timer = 0;
+            std::chrono::steady_clock::time_point sent;
+            std::function<void()> deferred;
+            bool deferredResizing = false;
+        };
+        /**
+         * @return nullptr if c doesn't sync (finding out the first time we're asked)
+         */
+        State* stateFor(const ClientPointer& c);
+        void request(Window w, State& state);
+        void caughtUp(Window w, bool timedOut);
+    private:
+        std::map<Window, State> _states;
+        bool _available = false;
+        int _eventBase = 0;
+        std::uint64_t _requests = 0;
+        std::uint64_t _answered = 0;
+        std::uint64_t _timeouts = 0;
+        std::uint64_t _deferred = 0;
+        double _totalLatency = 0;
+        double _worstLatency = 0;
+};
+
+// prefetch.c
+/**
+ * Everything makeNew needs to know about a window before managing it.
+ */
+struct WindowDetails {
+    // only the geometry, map_state, colormap and override_redirect are filled in
+    XWindowAttributes attributes {};
+    std::optional<std::string> title;
+    std::optional<std::string> wmClass;
+    std::optional<XWMHints> hints;
+    // flags is 0 if the window has no WM_NORMAL_HINTS
+    XSizeHints normalHints {};
+    Window transientFor = None;
+    std::vector<Atom> protocols;
+    long wmState = WithdrawnState;
+    bool shaped = false;
+};
+struct xcb_connection_t;
+/**
+ * Reads new windows' properties over an xcb connection of our own, so
+ * that the requests for any number of windows can all be sent before we
+ * wait for the first reply: a burst of windows costs one round trip
+ * rather than a dozen each. Without that connection we fall back to
+ * asking through Xlib, one window at a time.
+ */
+class WindowPrefetch final {
+    public:
+        static WindowPrefetch& instance() noexcept;
+        /**
+         * Send the requests for w's details without waiting for them.
+         */
+        void request(Window w);
+        /**
+         * w's details, requesting them first if request() wasn't called.
+         * @return nothing if the window has gone away
+         */
+        std::optional<WindowDetails> take(Window w);
+        /**
+         * A top level window has been created, and may well be mapped
+         * shortly: start reading its details as soon as it's safe to.
+         */
+        void created(Window w);
+        /**
+         * Send the requests for created windows once the server has seen
+         * that we're listening for changes to them. Called at the end of
+         * every batch.
+         */
+        void speculate();
+        /**
+         * Something about a window we don't manage yet has changed, so
+         * whatever we read about it is out of date.
+         */
+        void propertyChanged(Window w, Atom property);
+        void shapeChanged(Window w);
+        /**
+         * We've configured a window we don't manage yet (on its behalf).
+         */
+        void configured(Window w, unsigned int mask, const XWindowChanges& changes);
+        /**
+         * The window has gone; drop whatever we were reading about it.
+         */
+        void forget(Window w);
+        ~WindowPrefetch();
+        WindowPrefetch(const WindowPrefetch&) = delete;
+        WindowPrefetch& operator=(const WindowPrefetch&) = delete;
+    private:
+        WindowPrefetch() = default;
+        bool connect() noexcept;
+        std::optional<WindowDetails> readWithXlib(Window w);
+        void invalidate(Window w, int item);
+        struct Pending;
+    private:
+        xcb_connection_t* _connection = nullptr;
+        bool _tried = false;
+        std::map<Window, std::unique_ptr<Pending>> _pending;
+        // created windows, oldest first, with the serial of our XSelectInput and whether we've sent their requests
+        std::deque<std::tuple<Window, unsigned long, bool>> _speculative;
+        std::map<Window, std::tuple<unsigned int, XWindowChanges>> _configured;
+};
 
 // taskbar.c
 
+// launch.c
+/**
+ * Runs commands for us from a small helper process forked at startup.
+ */
+class LaunchService final {
+    public:
+        static LaunchService& instance() noexcept;
+        /**
+         * Fork the helper process. Call this as early as possible, and
+         * certainly before the display is opened, so that the helper is
+         * as small as it can be and doesn't hold on to the X connection.
+         */
+        void start() noexcept;
+        /**
+         * Hand the command to the helper to run with $SHELL -c.
+         * @param id the launch id from LaunchTelemetry, used for the startup notification id
+         * @return false if the helper isn't available, in which case the caller has to run it some other way
+         */
+        bool launch(std::uint32_t id, const std::string& cmd) noexcept;
+        /**
+         * The startup notification id we give the command with the given launch id.
+         */
+        static std::string startupId(std::uint32_t id) noexcept;
+    private:
+        LaunchService() = default;
+        void readReplies() noexcept;
+    private:
+        pid_t _helper = -1;
+        int _requests = -1;
+        int _replies = -1;
+};
+
+/**
+ * Keeps track of how long each menu command takes to put a window up.
+ * Each launch is matched up with the client it eventually produces,
+ * either by the startup notification id we put in its environment
+ * (_NET_STARTUP_ID) or by its _NET_WM_PID being the process we started
+ * or a descendant of it.
+ *
+ * The rolling statistics for each command are published as text on the
+ * root window's _WINDOWLAB_LAUNCH_STATS property (xprop -root
+ * _WINDOWLAB_LAUNCH_STATS) and kept in $XDG_CACHE_HOME/windowlab.
+ */
+class LaunchTelemetry final {
+    public:
+        static LaunchTelemetry& instance() noexcept;
+        /**
+         * Note that we have just asked for cmd to be run.
+         * @return the id for this launch
+         */
+        std::uint32_t launched(const std::string& cmd) noexcept;
+        /**
+         * The process for the given launch has been started.
+         */
+        void spawned(std::uint32_t id, pid_t pid) noexcept;
+        /**
+         * A new client has asked to be mapped; see if it belongs to one of our launches.
+         */
+        void mapped(ClientPointer c) noexcept;
+        /**
+         * A client's frame has been exposed.
+         */
+        void exposed(ClientPointer c) noexcept;
+        /**
+         * The current statistics, one line per command.
+         */
+        std::string report() const noexcept;
+        void load() noexcept;
+        void save() const noexcept;
+    private:
+        LaunchTelemetry() = default;
+        void expire() noexcept;
+        void publish() noexcept;
+    private:
+        using Clock = std::chrono::steady_clock;
+        struct Pending {
+            std::uint32_t id;
+            std::string command;
+            Clock::time_point launchedAt;
+            pid_t pid = -1;
+            Window window = None;
+        };
+        // how many of the most recent samples the statistics cover
+        static constexpr std::size_t WINDOW_SIZE = 16;
+        struct Samples {
+            std::vector<double> values;
+            std::size_t next = 0;
+            void add(double value) noexcept;
+            std::tuple<double, double, double> summarise() const noexcept;
+        };
+        struct Statistics {
+            std::uint64_t launches = 0;
+            Samples toMapRequest;
+            Samples toExpose;
+        };
+        std::uint32_t _nextId = 1;
+        std::vector<Pending> _pending;
+        std::map<std::string, Statistics> _statistics;
+};
+
+// watch.c
+/**
+ * Thin wrapper around inotify which runs out of the event loop. More
+ * than one part of the window manager can watch the same directory;
+ * inotify only gives us one watch per directory so we share it.
+ */
+class FileWatcher final {
+    public:
+        using Callback = std::function<void(const std::string&)>;
+        static FileWatcher& instance() noexcept;
+        /**
+         * Watch a directory for changes.
+         * @param dir the directory to watch
+         * @param mask the inotify events we are interested in
+         * @param fn called with the name of the directory entry each event was for
+         * @return a handle for unwatch(), or -1 if the directory couldn't be watched
+         */
+        int watchDirectory(const std::filesystem::path& dir, std::uint32_t mask, Callback fn) noexcept;
+        void unwatch(int handle) noexcept;
+    private:
+        FileWatcher() = default;
+        void dispatch() noexcept;
+    private:
+        int _fd = -1;
+        int _nextHandle = 0;
+        // watch descriptor -> (handle -> callback)
+        std::map<int, std::map<int, Callback>> _watches;
+        // handle -> watch descriptor
+        std::map<int, int> _handles;
+};
+
+// fuzzy.c
+/**
+ * A set of strings which can be searched with a fuzzy subsequence match
+ * (typing "ffx" finds "firefox"). The strings are case folded and kept
+ * back to back in one buffer so that a search is a single linear pass
+ * over memory; each also has a bitmask of the characters it contains so
+ * that most candidates can be thrown out without looking at them at all.
+ */
+class FuzzyIndex final {
+    public:
+        struct Match {
+            int score;
+            std::uint32_t index;
+        };
+        void clear() noexcept;
+        void reserve(std::size_t count, std::size_t bytes);
+        void add(std::string_view text);
+        std::size_t size() const noexcept { return _masks.size(); }
+        bool empty() const noexcept { return _masks.empty(); }
+        /**
+         * Find the entries which contain all of query's characters in order.
+         * @param limit the most matches to return
+         * @return the best matches, highest score first; ties go to the entry added first
+         */
+        std::vector<Match> search(std::string_view query, std::size_t limit) const;
+    private:
+        std::string _text;
+        std::vector<std::uint32_t> _offsets;
+        std::vector<std::uint64_t> _masks;
+};
+
+// pathindex.c
+/**
+ * Every executable on $PATH, for the launcher. The directories are
+ * scanned in parallel on another thread, kept up to date with inotify,
+ * and the index is kept in the cache directory so that normally nothing
+ * needs scanning at all.
+ */
+class PathIndex final {
+    public:
+        static PathIndex& instance() noexcept;
+        /**
+         * Search the index as it stands. Any directories that have changed
+         * since they were scanned are rescanned in the background.
+         * @param updated called from the event loop once a rescan this started has made it into the index
+         */
+        std::vector<FuzzyIndex::Match> search(std::string_view query, std::size_t limit, std::function<void()> updated);
+        const std::string& at(std::size_t index) const noexcept { return _names[index]; }
+        std::size_t size() const noexcept { return _names.size(); }
+    private:
+        PathIndex() = default;
+        struct Directory {
+            std::filesystem::path path;
+            std::int64_t modified = 0;
+            std::vector<std::string> names;
+            bool stale = true;
+            int watch = -1;
+        };
+        void load();
+        void rebuild();
+        void scanStale();
+        void scanFinished();
+        bool loadCache();
+        void saveCache() const;
+    private:
+        std::string _searchPath;
+        std::vector<Directory> _directories;
+        std::vector<std::string> _names;
+        FuzzyIndex _index;
+        // the scanner thread tells us it's done through this
+        int _scanDone[2] = { -1, -1 };
+        bool _scanning = false;
+        std::function<void()> _updated;
+};
+
 // menufile.c
 class Menu final {
     public:
@@ -793,8 +2000,8 @@ class Menu final {
         std::shared_ptr<MenuItem> at(std::size_t index) noexcept;
         const auto& getMenuItems() const noexcept { return _menuItems; }
         std::size_t size() const noexcept { return _menuItems.size(); }
-        void requestMenuItemUpdate() noexcept { _updateMenuItems = true; }
-        constexpr bool shouldRepopulate() const noexcept { return _updateMenuItems; }
+        void requestMenuItemUpdate() noexcept { _updateMenuItems = 1; }
+        bool shouldRepopulate() const noexcept { return _updateMenuItems; }
         auto begin() const noexcept { return _menuItems.begin(); }
         auto end() const noexcept { return _menuItems.end(); }
         auto cbegin() const noexcept { return _menuItems.begin(); }
@@ -802,11 +2009,55 @@ class Menu final {
         auto begin() noexcept { return _menuItems.begin(); }
         auto end() noexcept { return _menuItems.end(); }
         void populate() noexcept;
+        using Items = std::vector<std::shared_ptr<MenuItem>>;
+        /**
+         * What came out of the menurc file, along with enough about the
+         * file itself to tell whether a cached layout still applies.
+         */
+        struct Contents {
+            Items items;
+            std::filesystem::path source;
+            std::int64_t modified = 0;
+            std::uintmax_t size = 0;
+            // which call to load() this came from; later loads get bigger numbers
+            std::uint64_t generation = 0;
+        };
+        /**
+         * Read and parse the menurc file, or pick up the items from the
+         * menu cache if the file hasn't changed since it was written. This
+         * doesn't touch X or the menu itself so it is safe to call from
+         * another thread.
+         */
+        static Contents load() noexcept;
+        /**
+         * Replace the menu with the given items and lay them out, if we have a font to measure them with yet.
+         * @return false if a load started after this one has come along since, in which case the items are dropped
+         */
+        bool install(Contents&& contents) noexcept;
+        /**
+         * Work out where each item goes on the menubar using the current
+         * font. Only items which don't already know their width (i.e. didn't
+         * come from the cache) are measured.
+         */
+        void measure() noexcept;
+        /**
+         * Find the item under the given x co-ordinate of the menubar.
+         * @return the index of the item, or size() if there isn't one there
+         */
+        std::size_t itemAt(int x) const noexcept;
     private:
         Menu() = default;
+        void watchSources() noexcept;
+        void saveCache() const noexcept;
+        static bool loadCache(Contents& contents) noexcept;
     private:
-        std::vector<std::shared_ptr<MenuItem>> _menuItems;
-        bool _updateMenuItems = true;
+        Items _menuItems;
+        // set from the SIGHUP handler
+        volatile std::sig_atomic_t _updateMenuItems = 0;
+        std::filesystem::path _source;
+        std::int64_t _modified = 0;
+        std::uintmax_t _size = 0;
+        std::vector<int> _watches;
 };
 const std::filesystem::path& getDefMenuRc() noexcept;
 constexpr auto debugActive() noexcept {